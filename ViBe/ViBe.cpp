@@ -1,29 +1,178 @@
 #include <iostream>
 #include <cmath>
+#include <cstring>
 #include "ViBe.h"
 
 using namespace std;
 using namespace cv;
 
+// Fills sample planes [from, to) of a padded (height, width, N) model, every sample is taken
+// from a random neighbor of the pixel in img, which has the same border as the model. Rows are
+// independent, each row draws from its own generator so the result does not depend on how the
+// rows are split between threads.
+class SampleFiller : public ParallelLoopBody{
+public:
+	SampleFiller(const Mat& img, Mat& model, int n, int from, int to, uint64 seed, const vector<Point>& deltas):
+		img(img), model(model), N(n), from(from), to(to), seed(seed){
+		for(const Point& d : deltas)
+			offsets.push_back(d.y*(int)img.step + d.x*(int)img.elemSize());
+	}
+
+	void operator()(const Range& rows) const{
+		const int elem = img.elemSize(), cols = img.cols - 2*NEIGHBOR_RANGE;
+		for(int i = rows.start; i < rows.end; i++){
+			RNG rng(seed + (uint64)(i+1)*0x9E3779B97F4A7C15ULL);
+			const uchar* src = img.ptr<uchar>(i + NEIGHBOR_RANGE) + NEIGHBOR_RANGE*elem;
+			uchar* dst = model.ptr<uchar>(i + NEIGHBOR_RANGE) + NEIGHBOR_RANGE*N*elem;
+			for(int j = 0; j < cols; j++, src += elem){
+				for(int k = from; k < to; k++){
+					const uchar* neighbor = src + offsets[rng.uniform(0, NEIGHBOR_COUNT)];
+					uchar* sample = dst + (j*N + k)*elem;
+					for(int c = 0; c < elem; c++)
+						sample[c] = neighbor[c];
+				}
+			}
+		}
+	}
+
+private:
+	const Mat& img;
+	Mat& model;
+	int N, from, to;
+	uint64 seed;
+	vector<int> offsets;
+};
+
 ViBe::ViBe( int n, int r, int min, int s ){
 	N = n;
 	R = r*r;
 	thresh_min = min;
 	sub = s;
+	blob_num = 0;
+	sample_index = 0;
+	init_frames = 1;
+	rng = RNG(time(NULL));
+	frame_budget = 0;
+	fill_mode = FILL_PREVIOUS;
+	degradation = 0;
+	pinned_degradation = -1;
+	processed_ratio = 1;
+	pixel_cost = 0;
+	blob_cost = 0;
+	budget_frame = 0;
+	setDecimation(1);
+	kernel = KERNEL_ROW;
+	input_layout = INPUT_PACKED;
+	use_chroma = false;
+	burst_seed = 0;
+	label_row_begin = 0;
+	stream_row = 0;
+	stream_bboxes = true;
+	frame_number = 0;
+	pipe_slot = 0;
+	pipe_rot_bboxes = false;
+	label_request = label_done = -1;
+	label_stop = false;
+	label_bits = NULL;
+	label_set = NULL;
+	for(int y = -NEIGHBOR_RANGE; y <= NEIGHBOR_RANGE; y++)
+		for(int x = -NEIGHBOR_RANGE; x <= NEIGHBOR_RANGE; x++)
+			if(x != 0 || y != 0)
+				neighbor_deltas.push_back(Point(x, y));
 	cout << "ViBe()" << endl;
 }
 
 ViBe::~ViBe(){
+	stop_labelling();
 	cout << "~ViBe()" << endl;
 }
 
-// this strange little hack with the global variable k supports the legacy way of initializing vibe, as well as a new way.
+// Each source frame updates a background pixel with probability p = 1/sub. When only one of k
+// frames is processed, the update probability per processed frame becomes 1-(1-p)^k so that
+// the model adapts at the same wall-clock speed.
+void ViBe::setDecimation(int k){
+	decimation = std::max(1, k);
+	double p = 1.0 - pow(1.0 - 1.0/sub, decimation);
+	update_threshold = (uint64)(p*4294967296.0);
+}
+
+void ViBe::setSeed(uint64 seed){
+	rng = RNG(seed);
+}
+
+void ViBe::setKernel(int k){
+	kernel = k;
+}
+
+void ViBe::setInput(int layout, bool chroma){
+	input_layout = layout;
+	use_chroma = chroma && layout != INPUT_PACKED;
+}
+
+void ViBe::setInitFrames(int k){
+	init_frames = std::max(1, std::min(k, N));
+}
+
+void ViBe::fill_samples( const Mat& img, Mat& model, int from, int to, uint64 seed ){
+	// 3-D matrix with a border, the neighbors of the edge pixels are read from a replicated border as well
+	int sample_size[] = {img.rows + 2*NEIGHBOR_RANGE, img.cols + 2*NEIGHBOR_RANGE, N};
+	model.create( 3, sample_size, img.type() );
+	Mat padded;
+	copyMakeBorder(img, padded, NEIGHBOR_RANGE, NEIGHBOR_RANGE, NEIGHBOR_RANGE, NEIGHBOR_RANGE, BORDER_REPLICATE);
+	parallel_for_(Range(0, img.rows), SampleFiller(padded, model, N, from, to, seed, neighbor_deltas));
+}
+
+// called whenever samples gets new storage, sets up everything that depends on its layout
+void ViBe::attach_samples(){
+	const int rows = samples.size[0], cols = samples.size[1];
+	const int step = samples.step[0], cell = N*samples.elemSize();
+	const Range interior[] = {Range(NEIGHBOR_RANGE, rows-NEIGHBOR_RANGE), Range(NEIGHBOR_RANGE, cols-NEIGHBOR_RANGE), Range::all()};
+	sample_view = Mat(samples, interior);
+
+	neighbor_offsets.clear();
+	for(const Point& d : neighbor_deltas)
+		neighbor_offsets.push_back(d.y*step + d.x*cell);
+
+	border_cells.clear();
+	for(int y = 0; y < rows; y++){
+		bool inner_row = y >= NEIGHBOR_RANGE && y < rows-NEIGHBOR_RANGE;
+		int edge_y = std::min(std::max(y, NEIGHBOR_RANGE), rows-NEIGHBOR_RANGE-1);
+		for(int x = 0; x < cols; x++){
+			if(inner_row && x == NEIGHBOR_RANGE)
+				x = cols-NEIGHBOR_RANGE;
+			int edge_x = std::min(std::max(x, NEIGHBOR_RANGE), cols-NEIGHBOR_RANGE-1);
+			border_cells.push_back(make_pair(y*step + x*cell, edge_y*step + edge_x*cell));
+		}
+	}
+	border_snapshot.resize(border_cells.size()*cell);
+	refresh_border(false);
+}
+
+// The border is never classified, it only takes the neighbor updates of the edge pixels so
+// that the update path needs no boundary test. A border sample that changed since the last
+// refresh is such an update, with fold it is given to the edge pixel the border cell replicates.
+// The border is then replicated again from the edge pixels, this only touches the perimeter.
+void ViBe::refresh_border( bool fold ){
+	uchar* base = samples.data;
+	const int elem = samples.elemSize(), cell = N*elem;
+	for( unsigned int k = 0; fold && k < border_cells.size(); k++ ){
+		const uchar* border = base + border_cells[k].first;
+		const uchar* snapshot = &border_snapshot[k*cell];
+		uchar* edge = base + border_cells[k].second;
+		for( int s = 0; s < cell; s += elem )
+			if( memcmp(border + s, snapshot + s, elem) != 0 )
+				memcpy(edge + s, border + s, elem);
+	}
+	for( unsigned int k = 0; k < border_cells.size(); k++ ){
+		memcpy(base + border_cells[k].first, base + border_cells[k].second, cell);
+		memcpy(&border_snapshot[k*cell], base + border_cells[k].second, cell);
+	}
+}
+
 // after initialization, the user program can call generate_samples up to N-1 times to replace the static image samples with
 // samples from a variety of images. Typically, one would sample with a bunch of widely spaced images. 
-
-int k=0;
 void ViBe::generate_samples( const Mat& img, const string& samples_name ) {
-	if(k>=N) return;
+	if(sample_index>=N) return;
 	
 	// Initialize samples if the initialization samples are given
 	if( !samples_name.empty() ){
@@ -35,24 +184,9 @@ void ViBe::generate_samples( const Mat& img, const string& samples_name ) {
 		}
 	}
 	// If the initialization samples are not given, use the given image.
-	// 3-D matrix
-	int sample_size[] = {height, width, N};
-	// if samples are empty, create space
-	if(samples.empty())
-		samples.create( 3, sample_size, type );
-	
-	for( int i = 0; i < height; i++){
-		for( int j = 0; j < width; j++ ){
-			// initialize samples of every pixel with neighboring pixels
-			Point neighbor = getRandomNeighbor(i, j);
-			if(type == CV_8UC1)
-				samples.at<uchar>(i, j, k) = img.ptr<uchar>(neighbor.y)[neighbor.x];
-			if(type == CV_8UC3){
-				samples.at<Vec3b>(i, j, k) = img.ptr<Vec3b>(neighbor.y)[neighbor.x];//data[img.channels()*neighbor.y*img.cols + neighbor.x];//
-			}
-		}
-	}
-	k++;
+	fill_samples(img, samples, sample_index, sample_index+1, rng.next());
+	attach_samples();
+	sample_index++;
 }
 
 
@@ -62,22 +196,73 @@ void ViBe::initialize( const Mat &img, const string& samples_name  ){
 	height = img.rows;
 	type = img.type();
 	
-	foreground.create(height, width, CV_8UC1);
+	fore_bits.create(width, height);
 	
 	if( samples_name.empty() ){
 		cout << "samples empty" << endl;
 	}else{
 		cout << "samples not empty" << endl;
+		readSamplesFromFile(samples_name);
+		if( samples.empty() )
+			cout << "could not load sample file: " << samples_name << endl;
 	}
 
-	while(k<N) {
-		generate_samples(img, samples_name );
-		k++;
+	// fill every sample plane in one pass
+	init_burst.clear();
+	if( samples.empty() ){
+		fill_samples(img, samples, 0, N, rng.next());
+		attach_samples();
+		// keep the first frames to seed a temporally diverse model
+		if(init_frames > 1)
+			init_burst.push_back(img.clone());
 	}
-	k=1; 
+	// the chroma model always comes from the first frame
+	if( use_chroma )
+		fill_samples(chroma_image, chroma_samples, 0, N, rng.next());
+	sample_index = 1;
 	
 	cout << "initialization finished" << endl;
-	srand( time(NULL) );
+}
+
+// called for every frame of the initialization burst, once all the frames are collected a
+// new model is built in the background while the last of them is classified
+void ViBe::collect_init_frame( const Mat& img ){
+	begin_init_frame();
+	end_init_frame(img);
+}
+
+// the part before the classification of the frame: swap in the new model on the frame after
+// the burst, waiting for it if needed so that the results do not depend on timing, or draw
+// the seed of the model if this frame completes the burst
+void ViBe::begin_init_frame(){
+	if( init_model.valid() ){
+		samples = init_model.get();
+		attach_samples();
+		cout << "burst initialization finished" << endl;
+		return;
+	}
+	if( !init_burst.empty() && (int)init_burst.size() + 1 >= init_frames )
+		burst_seed = rng.next();
+}
+
+// the part that needs the whole frame
+void ViBe::end_init_frame( const Mat& img ){
+	if( init_model.valid() || init_burst.empty() )	return;
+
+	init_burst.push_back(img.clone());
+	if( (int)init_burst.size() < init_frames )	return;
+
+	std::vector<Mat> burst;
+	burst.swap(init_burst);
+	uint64 seed = burst_seed;
+	init_model = std::async(std::launch::async, [this, burst, seed](){
+		// frame f seeds planes [f*N/K, (f+1)*N/K)
+		Mat model;
+		int K = burst.size();
+		for(int f = 0; f < K; f++)
+			fill_samples(burst[f], model, f*N/K, (f+1)*N/K, seed + f);
+		return model;
+	});
 }
 
 void ViBe::pixel_process( int row, int col){
@@ -86,6 +271,8 @@ void ViBe::pixel_process( int row, int col){
 	// while not enough close samples and there is still sample not checked
 	while( (count < thresh_min) && index < N ){
 		dist = getDist( image, samples, row, col, index);
+		if( use_chroma )
+			dist += getChromaDist(row, col, index);
 		if( dist < R )
 			count++;
 		if(count >= thresh_min)	break;	// break early
@@ -96,86 +283,409 @@ void ViBe::pixel_process( int row, int col){
 	// 2. classify pixel and update model
 	if(count >= thresh_min){
 		// make this pixel background
-		foreground.ptr<uchar>(row)[col] = COLOR_BACKGROUND;
+		fore_bits.set(row, col, false);
 
 		// 3. update current background model
-		// get random number between 0 and sub
-		sub_rand = random()%(sub-1);
-		if( sub_rand == 0 ){
+		// with probability 1/sub, rescaled when frames are decimated
+		if( rng.next() < update_threshold ){
 			//cout << "update sample\t( " << row << " , " << col << ")" << endl;
 			// replace randomly chosen sample
-			sub_rand = random()%(N-1);
+			sub_rand = rng.uniform(0, N);
 			if( type == CV_8UC1 )
-				samples.at<uchar>(row, col, sub_rand) = image.ptr<uchar>(row)[col];
+				sample_ptr(row, col)[sub_rand] = image.ptr<uchar>(row)[col];
 			if( type == CV_8UC3 )
-				samples.at<Vec3b>(row, col, sub_rand) = image.ptr<Vec3b>(row)[col];
+				((Vec3b*)sample_ptr(row, col))[sub_rand] = image.ptr<Vec3b>(row)[col];
+			if( use_chroma )
+				update_chroma(row, col, sub_rand);
 
 		}
 		// 4. update neighboring pixel model
-		sub_rand = random()%(sub-1);	
-		if( sub_rand == 0 ){
+		if( rng.next() < update_threshold ){
 			//cout << "update neighbor\t( " << row << " , " << col << ")\t";
-			// choose neighboring pixel randomly
+			// choose neighboring pixel randomly, it may be in the border of the model
 			Point neighbor = getRandomNeighbor(row, col);
 			//cout << neighbor << endl;
-			sub_rand = random()%(N-1);
+			sub_rand = rng.uniform(0, N);
 			if( type == CV_8UC1 )
-				samples.at<uchar>(neighbor.y, neighbor.x, sub_rand) = image.ptr<uchar>(row)[col];
+				sample_ptr(neighbor.y, neighbor.x)[sub_rand] = image.ptr<uchar>(row)[col];
 			if( type == CV_8UC3 )
-				samples.at<Vec3b>(neighbor.y, neighbor.x, sub_rand) = image.ptr<Vec3b>(row)[col];
+				((Vec3b*)sample_ptr(neighbor.y, neighbor.x))[sub_rand] = image.ptr<Vec3b>(row)[col];
 
 		}
 
 	}else{
 		// store this pixel as foreground
-		foreground.ptr<uchar>(row)[col] = COLOR_FOREGROUND;
+		fore_bits.set(row, col, true);
 	}
 }
 
+// classify and update pixels from, from+step, ... of a row
+void ViBe::classify_row( int row, int from, int step ){
+	if( kernel == KERNEL_REFERENCE ){
+		for( int j = from; j < width; j += step ){
+			//cout << "(" << row << " , " << j << ")" << endl;
+			pixel_process(row, j);
+		}
+	}else if( use_chroma )
+		process_row<1, true>(row, from, step);
+	else if( type == CV_8UC1 )
+		process_row<1, false>(row, from, step);
+	else
+		process_row<3, false>(row, from, step);
+}
+
+// Same as pixel_process over a row, with the random numbers drawn in the same order,
+// but the pixel, its samples and its mask are reached through row pointers and the neighbors
+// through constant offsets, the border of the model takes the updates that leave the frame.
+// With CHROMA the UV distance of the pixel's block is added to the Y distance. The
+// classification of 64 pixels is gathered in a word and merged once into the foreground bits.
+template<int CN, bool CHROMA>
+void ViBe::process_row( int row, int from, int step ){
+	const uchar* img = image.ptr<uchar>(row);
+	uchar* model = sample_ptr(row, 0);
+	const int* neighbors = &neighbor_offsets[0];
+	uint64_t* bits = fore_bits.row(row);
+	uint64_t word = 0, touched = 0;
+	int current = from >> 6;
+	const uchar* uv = CHROMA ? chroma_image.ptr<uchar>(row/2) : NULL;
+	const uchar* uv_model = CHROMA ? chroma_ptr(row, 0) : NULL;
+
+	for( int col = from; col < width; col += step ){
+		if( (col >> 6) != current ){
+			bits[current] = (bits[current] & ~touched) | word;
+			word = touched = 0;
+			current = col >> 6;
+		}
+		const uint64_t bit = uint64_t(1) << (col & 63);
+		touched |= bit;
+		const uchar* pixel = img + col*CN;
+		const uchar* sample = model + col*N*CN;
+
+		// 1. compare pixel to background model, break early
+		int count = 0;
+		for( int index = 0; index < N; index++, sample += CN ){
+			int dist = 0;
+			for( int c = 0; c < CN; c++ ){
+				int diff = pixel[c] - sample[c];
+				dist += diff*diff;
+			}
+			if( CHROMA ){
+				const uchar* c = uv + (col/2)*2, *c_sample = uv_model + ((col/2)*N + index)*2;
+				int du = c[0] - c_sample[0], dv = c[1] - c_sample[1];
+				dist += du*du + dv*dv;
+			}
+			if( dist < R && ++count >= thresh_min )
+				break;
+		}
+
+		// 2. classify pixel and update model
+		if( count < thresh_min ){
+			word |= bit;
+			continue;
+		}
+
+		// 3. update current background model
+		if( rng.next() < update_threshold ){
+			int index = rng.uniform(0, N);
+			uchar* dst = model + (col*N + index)*CN;
+			for( int c = 0; c < CN; c++ )
+				dst[c] = pixel[c];
+			if( CHROMA )
+				update_chroma(row, col, index);
+		}
+		// 4. update neighboring pixel model
+		if( rng.next() < update_threshold ){
+			uchar* neighbor = model + col*N*CN + neighbors[rng.uniform(0, NEIGHBOR_COUNT)];
+			uchar* dst = neighbor + rng.uniform(0, N)*CN;
+			for( int c = 0; c < CN; c++ )
+				dst[c] = pixel[c];
+		}
+	}
+	if( touched )
+		bits[current] = (bits[current] & ~touched) | word;
+}
+
 bool ViBe::process(const Mat &frame, Mat &fore, const string& samples_name, bool if_bboxes){
+	if( !process(frame, samples_name, if_bboxes) )
+		return false;
+	getForeground(fore);
+	return true;
+}
+
+void ViBe::getForeground(Mat &fore){
+	pool.create(foreground, height, width, CV_8UC1);
+	fore_bits.toMat(foreground, COLOR_FOREGROUND);
+	fore = foreground;
+}
+
+bool ViBe::process(const Mat &frame, const string& samples_name, bool if_bboxes){
 	if( frame.cols <= 0 || frame.rows <= 0 ){
 		cout << "this frame is empty" << endl;
 		return false;
 	}
+	Mat luma = frame;
+	if( input_layout != INPUT_PACKED && !split_planes(frame, luma) )
+		return false;
 	if( image.empty() )
-		initialize( frame, samples_name );
+		initialize( luma, samples_name );
 	else{
-		image = frame;
-		for( int i = 0; i < height; i++ )
-			for( int j = 0; j < width; j++ ){
-				//cout << "(" << i << " , " << j << ")" << endl;
-				pixel_process(i, j);
-			}
+		collect_init_frame(luma);
+		image = luma;
+		if( frame_budget > 0 || pinned_degradation >= 0 )
+			process_budgeted();
+		else
+			for( int i = 0; i < height; i++ )
+				classify_row(i, 0, 1);
+		refresh_border(true);
 	}
-	fore = foreground;
-	if(if_bboxes)
+	// labelling on the pipeline thread does not count in the frame budget
+	if( if_bboxes && blob_callback )
+		pipeline_blobs();
+	else if( if_bboxes ){
+		int64 begin = getTickCount();
 		findBlobs();
+		if( frame_budget > 0 ){
+			double ms = (getTickCount() - begin)*1000.0/getTickFrequency();
+			blob_cost = blob_cost > 0 ? 0.8*blob_cost + 0.2*ms : ms;
+		}
+	}
+	frame_number++;
 	return true;
 }
 
-// get rectangle mask from the fore ground
-void ViBe::getMask( Mat &fore, Mat & mask, bool drawContour ){
-	//erode(fore,fore,Mat());
-	//dilate(fore,fore,Mat());
+void ViBe::setPipelined( const BlobCallback& callback, bool rot_bboxes ){
+	flushBlobs();
+	blob_callback = callback;
+	pipe_rot_bboxes = rot_bboxes;
+	if( !blob_callback )
+		stop_labelling();
+	else if( !label_thread.joinable() )
+		label_thread = std::thread(&ViBe::label_loop, this);
+}
 
-	mask = cv::Mat::zeros(height, width, CV_8UC1);
+// The frame goes to the labelling thread with its own copy of the foreground, so that the
+// next frame can be classified into fore_bits meanwhile. The previous frame is given to the
+// callback first, the copy then takes the other slot, whose frame is one callback older.
+// The slots alternate between pipelined frames only, whatever is processed in between.
+// The thread is handed one frame at a time, so nothing is allocated from frame to frame.
+void ViBe::pipeline_blobs(){
+	flushBlobs();
+	pipe_slot ^= 1;
+	pipe_bits[pipe_slot] = fore_bits;
+	{
+		std::lock_guard<std::mutex> lock(label_mutex);
+		label_request = frame_number;
+	}
+	label_signal.notify_all();
+}
 
-	if(drawContour)
-		cvtColor(fore, fore, COLOR_GRAY2BGR);
+void ViBe::label_loop(){
+	std::unique_lock<std::mutex> lock(label_mutex);
+	for(;;){
+		label_signal.wait(lock, [this]{	return label_stop || label_request >= 0;	});
+		if( label_request < 0 )
+			return;
+		const long frame = label_request;
+		const BitMask& bits = pipe_bits[pipe_slot];
+		lock.unlock();
+
+		begin_labels(bits, pipe_blobs);
+		label_rows(0, bits.getHeight());
+		end_labels();
+		if( pipe_rot_bboxes )
+			pipe_blobs.getRotBboxes();
+
+		lock.lock();
+		label_request = -1;
+		label_done = frame;
+		label_signal.notify_all();
+	}
+}
 
-	for(unsigned int i=0; i < connected_area.size(); i++) {
-		Point2f vertices[4];
-		Point v[4];
-		rot_bboxes[i].points(vertices);
+void ViBe::flushBlobs(){
+	std::unique_lock<std::mutex> lock(label_mutex);
+	if( label_request < 0 && label_done < 0 )	return;
+	label_signal.wait(lock, [this]{	return label_done >= 0;	});
+	const long frame = label_done;
+	label_done = -1;
+	lock.unlock();
+
+	std::swap(blobs, pipe_blobs);
+	blob_num = blobs.size();
+	blob_callback(frame, pipe_bits[pipe_slot], blobs);
+}
 
-		for (int s = 0; s < 4; s++)
-			v[s] = Point(int(vertices[s].x), int(vertices[s].y));
+// the labelling buffers and pipe_blobs belong to the labelling thread while it has a frame
+unsigned long ViBe::getAllocationCount()	const{
+	std::unique_lock<std::mutex> lock(label_mutex);
+	label_signal.wait(lock, [this]{	return label_request < 0;	});
+	return pool.getAllocationCount() + label_pool.getAllocationCount() + blobs.getAllocationCount() + pipe_blobs.getAllocationCount();
+}
+
+// a frame still being labelled is finished first, it is not given to the callback
+void ViBe::stop_labelling(){
+	if( !label_thread.joinable() )	return;
+	{
+		std::lock_guard<std::mutex> lock(label_mutex);
+		label_stop = true;
+	}
+	label_signal.notify_all();
+	label_thread.join();
+	label_stop = false;
+	label_request = label_done = -1;
+}
+
+void ViBe::setFrameBudget(double budget_ms, int mode){
+	frame_budget = std::max(0.0, budget_ms);
+	fill_mode = mode;
+	degradation = 0;
+	processed_ratio = 1;
+}
+
+void ViBe::setDegradation(int level){
+	pinned_degradation = level < 0 ? -1 : std::min(level, MAX_DEGRADATION);
+}
+
+// lowest degradation level whose predicted time fits in the budget, with a 10% margin
+int ViBe::choose_degradation()	const{
+	double full = pixel_cost*width*height;
+	int level = 0;
+	while( level < MAX_DEGRADATION && blob_cost + full/(1 << level) > 0.9*frame_budget )
+		level++;
+	return level;
+}
+
+// Level 0 processes every pixel, level 1 a checkerboard, level L > 1 the checkerboard on one
+// of 2^(L-1) rows. The checkerboard phase and the row phase rotate every frame so that every
+// pixel is processed within 2^L frames. If the frame still runs over budget, the remaining
+// rows drop to the highest level.
+void ViBe::process_budgeted(){
+	int64 begin = getTickCount();
+	double tick_ms = 1000.0/getTickFrequency();
+	degradation = pinned_degradation >= 0 ? pinned_degradation : choose_degradation();
+	budget_frame++;
+
+	int level = degradation;
+	long processed = 0;
+	row_phase.assign(height, -2);
+	for( int i = 0; i < height; i++ ){
+		if( pinned_degradation < 0 && level < MAX_DEGRADATION && (i & 15) == 0 && (getTickCount() - begin)*tick_ms > frame_budget )
+			level = degradation = MAX_DEGRADATION;
+
+		if( level == 0 ){
+			row_phase[i] = -1;
+			classify_row(i, 0, 1);
+			processed += width;
+			continue;
+		}
+
+		int row_step = 1 << (level-1);
+		if( i % row_step != (budget_frame/2) % row_step )
+			continue;
+		int phase = (i + budget_frame) & 1;
+		row_phase[i] = phase;
+		classify_row(i, phase, 2);
+		processed += (width - phase + 1)/2;
+	}
+
+	processed_ratio = processed/double(width*height);
+	if( processed > 0 ){
+		double cost = (getTickCount() - begin)*tick_ms/processed;
+		pixel_cost = pixel_cost > 0 ? 0.8*pixel_cost + 0.2*cost : cost;
+	}
+	if( fill_mode == FILL_NEIGHBOR && degradation > 0 )
+		fill_skipped();
+}
+
+// give every skipped pixel the classification of the nearest processed pixel of this frame
+void ViBe::fill_skipped(){
+	const int words = fore_bits.getWordsPerRow();
+	for( int i = 0; i < height; i++ ){
+		if( row_phase[i] < 0 )	continue;
+		// the processed pixels have the parity of the phase, a skipped pixel copies its left neighbor
+		uint64_t* row = fore_bits.row(i);
+		const uint64_t processed = row_phase[i] ? 0xAAAAAAAAAAAAAAAAULL : 0x5555555555555555ULL;
+		const uint64_t first = row[0];
+		uint64_t carry = 0;
+		for( int k = 0; k < words; k++ ){
+			uint64_t w = row[k];
+			row[k] = (w & processed) | (((w << 1) | carry) & ~processed);
+			carry = w >> 63;
+		}
+		// the first pixel has no left neighbor, it copies its right one if any
+		if( row_phase[i] == 1 )
+			row[0] = (row[0] & ~uint64_t(1)) | ((width > 1 ? row[0] >> 1 : first) & 1);
+		row[words-1] &= fore_bits.lastWordMask();
+	}
+
+	for( int i = 0; i < height; i++ ){
+		if( row_phase[i] != -2 )	continue;
+		// nearest processed row, looking upwards first
+		for( int d = 1; d < height; d++ ){
+			int src = (i-d >= 0 && row_phase[i-d] != -2) ? i-d : 
+				(i+d < height && row_phase[i+d] != -2) ? i+d : -1;
+			if( src >= 0 ){
+				std::copy(fore_bits.row(src), fore_bits.row(src) + words, fore_bits.row(i));
+				break;
+			}
+		}
+	}
+}
 
-		if(drawContour){
-			rectangle(fore, bboxes[i], Scalar(0, 255, 0));
+// luma becomes a view of the Y plane, chroma_image the UV plane: a view for NV12, the two
+// quarter size planes interleaved for I420
+bool ViBe::split_planes( const Mat& frame, Mat& luma ){
+	if( frame.type() != CV_8UC1 || frame.rows % 3 != 0 || frame.cols % 2 != 0 || !frame.isContinuous() ){
+		cout << "a planar frame is a continuous CV_8UC1 of height*3/2 rows and even width" << endl;
+		return false;
+	}
+	const int h = frame.rows*2/3, ch = h/2, cw = frame.cols/2;
+	luma = frame.rowRange(0, h);
+	if( !use_chroma )	return true;
+
+	uchar* planes = (uchar*)frame.ptr<uchar>(h);
+	if( input_layout == INPUT_NV12 ){
+		chroma_image = Mat(ch, cw, CV_8UC2, planes, frame.step);
+		return true;
+	}
+	pool.create(chroma_image, ch, cw, CV_8UC2);
+	const uchar* u = planes, *v = planes + ch*cw;
+	for( int i = 0; i < ch; i++, u += cw, v += cw ){
+		uchar* dst = chroma_image.ptr<uchar>(i);
+		for( int j = 0; j < cw; j++ ){
+			dst[2*j] = u[j];
+			dst[2*j+1] = v[j];
 		}
+	}
+	return true;
+}
 
-		fillConvexPoly(mask, v, 4, 255);//Scalar(255, 255, 255));
+int ViBe::getChromaDist( int row, int col, int index ){
+	const uchar* c = chroma_image.ptr<uchar>(row/2) + (col/2)*2, *sample = chroma_ptr(row, col) + index*2;
+	int du = c[0] - sample[0], dv = c[1] - sample[1];
+	return du*du + dv*dv;
+}
+
+// the UV samples are shared by a 2x2 block, they follow the updates of the pixels' own samples
+void ViBe::update_chroma( int row, int col, int index ){
+	const uchar* c = chroma_image.ptr<uchar>(row/2) + (col/2)*2;
+	uchar* sample = chroma_ptr(row, col) + index*2;
+	sample[0] = c[0];
+	sample[1] = c[1];
+}
+
+// get rectangle mask from the fore ground
+void ViBe::getMask( Mat &fore, Mat & mask, bool drawContour ){
+	//erode(fore,fore,Mat());
+	//dilate(fore,fore,Mat());
+
+	// the rasterized rotated boxes are cached in the blob set, copy them out
+	blobs.getMask().copyTo(mask);
+
+	if(drawContour){
+		cvtColor(fore, fore, COLOR_GRAY2BGR);
+		for(const Rect& b : blobs.getBBoxes())
+			rectangle(fore, b, Scalar(0, 255, 0));
 	}
 }
 
@@ -183,7 +693,8 @@ void ViBe::getMask( Mat &fore, Mat & mask, bool drawContour ){
 void ViBe::saveSamplesToFile(const string& file_name){
 	cout << "save samples to file " << file_name << endl;
 	FileStorage fs( file_name, FileStorage::WRITE );
-	fs << string("samples") << samples;
+	// the border is not saved, it is rebuilt on reading
+	fs << string("samples") << sample_view.clone();
 	fs.release();
 }
 
@@ -191,8 +702,22 @@ void ViBe::readSamplesFromFile(const string& file_name){
 	// Assume mat has the same name with file_name
 	cout << "read samples from file " << file_name << endl;
 	FileStorage fs( file_name, FileStorage::READ );
-	fs[string("samples")] >> samples;
+	Mat file_samples;
+	fs[string("samples")] >> file_samples;
 	fs.release();
+
+	samples.release();
+	sample_view.release();
+	if( file_samples.empty() )	return;
+	if( file_samples.dims != 3 || file_samples.size[2] != N ){
+		cout << "sample file does not hold " << N << " samples per pixel" << endl;
+		return;
+	}
+	int sample_size[] = {file_samples.size[0] + 2*NEIGHBOR_RANGE, file_samples.size[1] + 2*NEIGHBOR_RANGE, N};
+	samples.create( 3, sample_size, file_samples.type() );
+	for( int i = 0; i < file_samples.size[0]; i++ )
+		memcpy(sample_ptr(i, 0), file_samples.ptr<uchar>(i), file_samples.step[0]);
+	attach_samples();
 }
 
 int ViBe::getBlobSize(){	
@@ -200,50 +725,26 @@ int ViBe::getBlobSize(){
 }
 
 Mat& ViBe::getSamples(){
-	return samples;
+	return sample_view;
 }
 
 Point ViBe::getRandomNeighbor( int row, int col){
-	// on both x and y direction, generate a random number
-	// use 8-connected neighbor
-	int rand_row=0, rand_col =0, row_from = NEIGHBOR_RANGE, row_to = NEIGHBOR_RANGE*2+1, 
-		col_from = NEIGHBOR_RANGE, col_to = NEIGHBOR_RANGE*2+1;
-	// deal with the edge pixels
-	if(row < NEIGHBOR_RANGE){
-		row_from = 0;
-		row_to = NEIGHBOR_RANGE+1;
-	}
-	if( row >= height-NEIGHBOR_RANGE){
-		row_to = NEIGHBOR_RANGE+1;
-	}
-	if( col < NEIGHBOR_RANGE){
-		col_from = 0;
-		col_to = NEIGHBOR_RANGE+1;
-	}
-	if( col >= height-NEIGHBOR_RANGE ){
-		col_to = NEIGHBOR_RANGE+1;
-	}
-
-	// return one of 8-connected neighbors except itself
-	do{
-		rand_row = random()% row_to - row_from;
-		rand_col = random()% col_to - col_from;
-	}while(rand_row == 0 && rand_col == 0);
-
-	//cout << "(" << rand_row+row << "," << rand_col+col << ")\t" << endl;
-	return Point( col+rand_col, row+rand_row );
+	// one of the 8-connected neighbors except itself, the neighbors of the edge pixels
+	// that are out of the frame fall in the border of the model
+	const Point& d = neighbor_deltas[rng.uniform(0, NEIGHBOR_COUNT)];
+	return Point( col+d.x, row+d.y );
 }	
 
 float ViBe::getDist( Mat &img, Mat &sample, int row, int col, int index ){
 	// because we use grayscale image, just do simple subtraction
 	if( type == CV_8UC1 ){
-		int dist = img.ptr<uchar>(row)[col] - sample.at<uchar>(row, col, index);
+		int dist = img.ptr<uchar>(row)[col] - sample.at<uchar>(row+NEIGHBOR_RANGE, col+NEIGHBOR_RANGE, index);
 		return dist*dist;
 	}
 	// compute Euclidean distance in 3D color space
 	if( type == CV_8UC3 ){
 		Vec3b img_color = img.ptr<Vec3b>(row)[col], 
-			  sample_color = sample.at<Vec3b>(row, col, index);
+			  sample_color = sample.at<Vec3b>(row+NEIGHBOR_RANGE, col+NEIGHBOR_RANGE, index);
 		int b_diff = img_color.val[0] - sample_color.val[0],
 			g_diff = img_color.val[1] - sample_color.val[1],
 			r_diff = img_color.val[2] - sample_color.val[2];
@@ -253,68 +754,173 @@ float ViBe::getDist( Mat &img, Mat &sample, int row, int col, int index ){
 }
 
 // find connected area and return the bounding rectangle
+// only the axis-aligned boxes are computed here, the rest of the blob geometry is computed on demand
 void ViBe::findBlobs()
 {
-	bboxes.clear();
-	rot_bboxes.clear();
-	connected_area.clear();
+	begin_labels(fore_bits, blobs);
+	label_rows(0, height);
+	end_labels();
+	blob_num = blobs.size();
+}
 
-	// Fill the label_image with the blobs
-	// 0  - background
-	// 255  - unlabelled foreground
-	// 1-254 - labelled foreground
+// The runs of the foreground bits are labelled with a union-find, row after row: two runs of
+// consecutive rows that overlap are 4-connected. The root of a blob is its first run in raster
+// order. A blob with a run in the row above and none in the new row cannot grow any more, it
+// is finished right away.
+void ViBe::begin_labels( const BitMask& bits, BlobSet& set )
+{
+	label_bits = &bits;
+	label_set = &set;
+	set.reset(bits.getWidth(), bits.getHeight());
+	runs.clear();
+	run_parent.clear();
+	run_box.clear();
+	run_next.clear();
+	run_tail.clear();
+	label_row_begin = 0;
+}
 
-	foreground.convertTo(label_image, CV_32FC1); // weird it doesn't support CV_32S!
+void ViBe::label_rows( int from, int to )
+{
+	for( int y = from; y < to; y++ ){
+		const int row_begin = runs.size();
+		label_bits->forEachRun(y, [this, y](int start, int end){
+			int k = runs.size();
+			label_pool.push_back(runs, BlobRun(y, start, end));
+			label_pool.push_back(run_parent, k);
+			label_pool.push_back(run_box, Vec4i(start, y, end-1, y));
+			label_pool.push_back(run_next, -1);
+			label_pool.push_back(run_tail, k);
+		});
+		const int row_end = runs.size();
+
+		// walk the runs of the row above and of this row together
+		int a = label_row_begin, b = row_begin;
+		while( a < row_begin && b < row_end ){
+			if( runs[a].end <= runs[b].start )	a++;
+			else if( runs[b].end <= runs[a].start )	b++;
+			else{
+				int ra = find_root(a), rb = find_root(b);
+				if( ra != rb ){
+					if( ra > rb )	std::swap(ra, rb);
+					run_parent[rb] = ra;
+					Vec4i& box = run_box[ra];
+					const Vec4i& other = run_box[rb];
+					box = Vec4i(std::min(box[0], other[0]), std::min(box[1], other[1]), std::max(box[2], other[2]), std::max(box[3], other[3]));
+					run_next[run_tail[ra]] = rb;
+					run_tail[ra] = run_tail[rb];
+				}
+				if( runs[a].end < runs[b].end )	a++;
+				else	b++;
+			}
+		}
 
-	int label_count = 1; // starts at 2 because 0,1 are used already
+		for( int k = label_row_begin; k < row_begin; k++ ){
+			int root = find_root(k);
+			if( run_box[root][1] >= 0 && run_box[root][3] < y )
+				finish_blob(root);
+		}
+		label_row_begin = row_begin;
+	}
+}
 
-	for(int y=0; y < foreground.rows; y++) {
-		for(int x=0; x < foreground.cols; x++) {
+void ViBe::end_labels()
+{
+	for( int k = label_row_begin; k < (int)runs.size(); k++ ){
+		int root = find_root(k);
+		if( run_box[root][1] >= 0 )
+			finish_blob(root);
+	}
+	label_set->finish();
+}
 
-			if((int)label_image.ptr<float>(y)[x] != 255) {
-				continue;
-			}
+void ViBe::finish_blob( int root )
+{
+	const Vec4i& box = run_box[root];
+	Rect bbox(box[0], box[1], box[2]-box[0]+1, box[3]-box[1]+1);
+	run_box[root][1] = -1;
+	// too small blobs are left out
+	if( bbox.area() <= MIN_BLOB_AREA )
+		return;
 
-			Rect bbox;
-			// give connected area the same label number
-			floodFill(label_image, Point(x,y), Scalar(label_count), &bbox, Scalar(0), Scalar(0), 4);
-
-			if( bbox.area() > MIN_BLOB_AREA){ 
-				vector <Point2i> pts_group;
-				bboxes.push_back(bbox);
-
-				for(int i=bbox.y; i < (bbox.y+bbox.height); i++) {
-					for(int j=bbox.x; j < (bbox.x+bbox.width); j++) {
-						if((int)label_image.ptr<float>(i)[j] != label_count) {
-							continue;
-						}
-						// get all the points in a connected area
-						pts_group.push_back(Point2i(j,i));
-					}
-				}
-				connected_area.push_back(pts_group);
-				label_count++;
-			}
-		}
+	// unions append lists out of order, the blob set wants its runs in raster order
+	blob_members.clear();
+	for( int k = root; k >= 0; k = run_next[k] )
+		label_pool.push_back(blob_members, k);
+	std::sort(blob_members.begin(), blob_members.end());
+	blob_runs.clear();
+	for( int k : blob_members )
+		label_pool.push_back(blob_runs, runs[k]);
+	label_set->add(bbox, &blob_runs[0], blob_runs.size());
+}
+
+int ViBe::find_root( int run )
+{
+	while( run_parent[run] != run ){
+		run_parent[run] = run_parent[run_parent[run]];
+		run = run_parent[run];
+	}
+	return run;
+}
+
+bool ViBe::beginFrame( const Size& size, int type, bool if_bboxes ){
+	if( blob_callback ){
+		cout << "streamed frames cannot be pipelined" << endl;
+		return false;
+	}
+	if( use_chroma || (!image.empty() && (size.width != width || size.height != height || type != this->type)) ){
+		cout << "streamed frames are packed or luma frames of the size of the first frame" << endl;
+		return false;
 	}
+	pool.create(stream_image, size.height, size.width, type);
+	stream_row = 0;
+	stream_bboxes = if_bboxes;
+	if( !image.empty() ){
+		begin_init_frame();
+		image = stream_image;
+		if( stream_bboxes )
+			begin_labels(fore_bits, blobs);
+	}
+	return true;
+}
 
-	sort(bboxes.begin(), bboxes.end(), ViBe::rect_larger_than);
-	blob_num = bboxes.size();
+int ViBe::processRows( const Mat& band ){
+	if( band.cols != stream_image.cols || band.type() != stream_image.type() || stream_row + band.rows > stream_image.rows ){
+		cout << "the band does not fit in the frame" << endl;
+		return image.empty() ? 0 : stream_row;
+	}
+	band.copyTo(stream_image.rowRange(stream_row, stream_row + band.rows));
+	const int from = stream_row;
+	stream_row += band.rows;
+	// the first frame only initializes the model, at endFrame
+	if( image.empty() )
+		return 0;
 
-	// get rotated rectangles
-	for(unsigned int i=0; i < connected_area.size(); i++) {
-		// get minimal bounding rotated rectangle of each blob
-		RotatedRect rot_box = minAreaRect(Mat(connected_area[i]));
-		Point2f vertices[4];
-		Point v[4];
-		rot_box.points(vertices);
+	for( int i = from; i < stream_row; i++ )
+		classify_row(i, 0, 1);
+	if( stream_bboxes )
+		label_rows(from, stream_row);
+	return stream_row;
+}
 
-		for (int s = 0; s < 4; s++)
-			v[s] = Point(int(vertices[s].x), int(vertices[s].y));
-		
-		// Add rotated rotated rectangle 
-		rot_bboxes.push_back(rot_box);
+bool ViBe::endFrame(){
+	if( stream_row != stream_image.rows ){
+		cout << "only " << stream_row << " rows of the frame were given" << endl;
+		return false;
+	}
+	if( image.empty() ){
+		initialize( stream_image );
+		if( stream_bboxes )
+			findBlobs();
+		return true;
 	}
+	end_init_frame(stream_image);
+	refresh_border(true);
+	if( stream_bboxes ){
+		end_labels();
+		blob_num = blobs.size();
+	}
+	return true;
 }
 
 
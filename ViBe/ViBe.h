@@ -3,6 +3,15 @@
 #include <cstdlib>
 #include <vector>
 #include <string>
+#include <future>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "bitMask.h"
+#include "blobSet.h"
+#include "bufferPool.h"
 
 #ifndef _VIBE_H_
 #define _VIBE_H_
@@ -10,8 +19,24 @@
 // background and foreground color value
 #define COLOR_BACKGROUND 0
 #define COLOR_FOREGROUND 255
-#define NEIGHBOR_RANGE 1
+#define NEIGHBOR_RANGE 1	// also the width of the border around the sample model
+#define NEIGHBOR_COUNT ((NEIGHBOR_RANGE*2+1)*(NEIGHBOR_RANGE*2+1)-1)
 #define MIN_BLOB_AREA 50
+// real-time mode: at degradation level L only one of 2^L pixels is processed
+#define MAX_DEGRADATION 3
+#define FILL_PREVIOUS 0		// skipped pixels keep their previous classification
+#define FILL_NEIGHBOR 1		// skipped pixels copy a processed neighbor of the same frame
+// classification kernels, both give the same results for the same seed
+#define KERNEL_REFERENCE 0	// pixel_process on every pixel
+#define KERNEL_ROW 1		// row pointer kernel (default)
+// layouts of the frames given to process
+#define INPUT_PACKED 0	// CV_8UC1 gray or CV_8UC3 BGR (default)
+#define INPUT_I420 1	// CV_8UC1 of height*3/2 rows: Y plane, U plane, V plane
+#define INPUT_NV12 2	// CV_8UC1 of height*3/2 rows: Y plane, interleaved UV plane
+
+// receives the number of a frame, 0 for the first frame given to process, with its
+// foreground and its blobs
+typedef std::function<void(long frame, const BitMask& fore, const BlobSet& blobs)> BlobCallback;
 
 class ViBe{
 public:
@@ -20,8 +45,60 @@ public:
 	void initialize( const cv::Mat &img, const std::string& samples_name = "" );
 	void pixel_process( int row, int col);
 	void generate_samples( const cv::Mat & img, const std::string& samples_name = "");
+	// seed the model from the first k frames instead of the first frame only (default 1).
+	// The new model is built in the background and used from frame k+1 on.
+	void setInitFrames(int k);
+	// only one of k source frames is given to process, rescale the update rates to keep
+	// the same adaptation speed (default 1)
+	void setDecimation(int k);
+	int getDecimation()	const{	return decimation;	}
+	// seed of the random numbers, call it before the first frame for reproducible results
+	void setSeed(cv::uint64 seed);
+	void setKernel(int k);
+	// planar 4:2:0 frames are classified without conversion, on the Y plane only or with
+	// chroma, compared against a half resolution UV model shared by each 2x2 block.
+	// Call it before the first frame.
+	void setInput(int layout, bool chroma = false);
 
 	bool process(const cv::Mat &frame, cv::Mat &fore, const std::string& samples_name = "", bool if_bboxes = true);		// if_bbox indicates whether to get bounding boxes
+	// same without converting the foreground to a byte mask, see getForegroundBits
+	bool process(const cv::Mat &frame, const std::string& samples_name = "", bool if_bboxes = true);
+
+	// Row band streaming, for frames that arrive a few rows at a time: beginFrame, then
+	// processRows with consecutive bands from the top row down, then endFrame. Each band is
+	// classified and updated as soon as it is given, with the same results as process.
+	// The frame budget and chroma input do not apply, the first frame is only used at endFrame.
+	bool beginFrame(const cv::Size& size, int type, bool if_bboxes = true);
+	// returns the number of rows from the top whose foreground is final in getForegroundBits,
+	// the blobs that no later row can touch are already in getBlobs, unsorted until endFrame
+	int processRows(const cv::Mat& band);
+	bool endFrame();
+
+	// Two-stage pipeline: process returns as soon as the frame is classified, its blobs are
+	// labelled on a second thread while the next frame is classified. The foreground and blobs
+	// of a frame are given to callback on the thread calling process, from the process call of
+	// the next frame or from flushBlobs, and stay valid until the callback of the next frame.
+	// With rot_bboxes the rotated boxes are also computed on the second thread.
+	// getBlobs is the last frame given to callback. An empty callback labels in process again.
+	void setPipelined(const BlobCallback& callback, bool rot_bboxes = false);
+	// wait for the frame being labelled and give it to the callback
+	void flushBlobs();
+	// foreground of the last frame, one bit per pixel
+	const BitMask& getForegroundBits()	const{	return fore_bits;	}
+	// the same as a CV_8UC1 COLOR_FOREGROUND/COLOR_BACKGROUND mask, converted on every call
+	void getForeground(cv::Mat &fore);
+
+	// real-time mode: keep each frame within budget_ms by processing only a rotating subset
+	// of the pixels when needed, 0 processes every pixel (default)
+	void setFrameBudget(double budget_ms, int fill_mode = FILL_PREVIOUS);
+	int getDegradation()	const{	return degradation;	}	// degradation level of the last frame
+	double getProcessedRatio()	const{	return processed_ratio;	}	// portion of the pixels processed in the last frame
+	// use the given degradation level on every frame whatever the budget, -1 lets the budget
+	// choose it again (default). Meant for tests, the subsets and fills do not depend on timing.
+	void setDegradation(int level);
+	// per row of the last real-time frame: -2 skipped, -1 all pixels, else the parity of the
+	// processed columns of its checkerboard
+	const std::vector<int>& getRowPhases()	const{	return row_phase;	}
 
 	void saveSamplesToFile(const std::string& file_name);
 	void readSamplesFromFile(const std::string& file_name);
@@ -32,35 +109,125 @@ public:
 	void getMaskedImg(cv::Mat &img, cv::Mat &mask);
 	bool isSamplesEmpty()	const{	return samples.empty();	}
 	int getBlobSize();
-	cv::Mat& getSamples();
-	std::vector< cv::RotatedRect > getRotBboxes(){	return rot_bboxes;	}	// get rotated bounding boxes
-	std::vector< cv::Rect > getBBoxes(){	return bboxes;	}	// get bounding boxes
+	cv::Mat& getSamples();	// (height, width, N) view of the model, without its border
+	const BlobSet& getBlobs()	const{	return blobs;	}	// blobs of the last frame, geometry computed on demand
+	const std::vector< cv::RotatedRect >& getRotBboxes()	const{	return blobs.getRotBboxes();	}	// get rotated bounding boxes
+	const std::vector< cv::Rect >& getBBoxes()	const{	return blobs.getBBoxes();	}	// get bounding boxes
+	// number of pooled buffer (re)allocations so far, it stays the same once the buffers are warm.
+	// The contours and rotated boxes computed on demand by OpenCV allocate outside the pools.
+	// Waits for the frame being labelled by the pipeline, if any.
+	unsigned long getAllocationCount()	const;
 
 private:
 	int N;				// number of samples per pixel(default 20)
 	int R;				// radius of the sphere(default 20)
 	int thresh_min;		// number of close samples for being part of the background(default 2)
 	int sub;			// amount of random subsampling(default 16)
+	int decimation;		// one of decimation source frames is processed(default 1)
+	cv::uint64 update_threshold;	// a 32 bit random number below this updates the model, 2^32/sub without decimation
+	int kernel;
+	int input_layout;
+	bool use_chroma;	// planar input compared on Y, U and V
 	int width;
 	int height;
 	int type;
 	int blob_num;
-	cv::Mat image;		// current image
-	cv::Mat samples;	// background model
-	cv::Mat foreground;	// foreground/background segmentation map
-	cv::Mat label_image;
-	std::vector<cv::Rect> bboxes;
-	std::vector<cv::RotatedRect> rot_bboxes;
-	std::vector<std::vector<cv::Point2i> > connected_area;
+	cv::Mat image;		// current image, the Y plane of planar input
+	cv::Mat chroma_image;	// half resolution CV_8UC2 UV of planar input
+	cv::Mat samples;	// background model, (height, width, N) with a NEIGHBOR_RANGE wide replicated border
+	cv::Mat sample_view;	// samples without the border
+	std::vector<cv::Point> neighbor_deltas;	// the neighbors of a pixel, the pixel itself excluded
+	std::vector<int> neighbor_offsets;	// the same neighbors as byte offsets in samples
+	std::vector< std::pair<int, int> > border_cells;	// byte offsets of a border cell and of the edge pixel it replicates
+	std::vector<uchar> border_snapshot;	// border samples after the last refresh
+	cv::Mat chroma_samples;	// UV model of planar input, (height/2, width/2, N) with the border of samples
+	BitMask fore_bits;	// foreground/background segmentation map
+	cv::Mat foreground;	// byte copy of fore_bits, made by getForeground
+	BlobSet blobs;
+	BufferPool pool;
+	// labelling buffers indexed by run, the rows are labelled one after another
+	const BitMask* label_bits;	// the foreground and the blob set being labelled
+	BlobSet* label_set;
+	BufferPool label_pool;	// labelling may run on the pipeline thread
+	std::vector<BlobRun> runs;
+	std::vector<int> run_parent;	// union-find forest, a root is the first run of its blob
+	std::vector<cv::Vec4i> run_box;		// min x, min y, max x, max y of the blob of a root, min y is -1 once finished
+	std::vector<int> run_next;	// the runs of a blob are a list starting at its root
+	std::vector<int> run_tail;	// last run of the list of a root
+	std::vector<int> blob_members;
+	std::vector<BlobRun> blob_runs;
+	int label_row_begin;	// first run of the last labelled row
+	cv::RNG rng;
+	int sample_index;	// next sample plane replaced by generate_samples
+	int init_frames;	// number of frames used to seed the model
+	std::vector<cv::Mat> init_burst;
+	std::future<cv::Mat> init_model;	// model built from init_burst in the background
+	cv::uint64 burst_seed;
+
+	// row band streaming
+	int stream_row;		// rows of the current frame given so far
+	bool stream_bboxes;
+	cv::Mat stream_image;
+
+	// two-stage pipeline, the labelling thread only uses the labelling buffers and pipe_blobs
+	BlobCallback blob_callback;
+	bool pipe_rot_bboxes;
+	long frame_number;	// frames given to process so far
+	BitMask pipe_bits[2];	// foreground of the frame being labelled and of the last one given to the callback
+	int pipe_slot;		// slot of pipe_bits of the last frame handed to the labelling thread
+	BlobSet pipe_blobs;	// blobs of the frame being labelled, swapped with blobs once given
+	std::thread label_thread;	// started by setPipelined, lives until the pipeline is turned off
+	mutable std::mutex label_mutex;
+	mutable std::condition_variable label_signal;	// both ways: a frame to label, a frame labelled
+	long label_request;	// frame handed to the labelling thread, -1 if none
+	long label_done;	// frame labelled and not given to the callback yet, -1 if none
+	bool label_stop;
+
+	void pipeline_blobs();
+	void label_loop();
+	void stop_labelling();
+
+	void fill_samples( const cv::Mat& img, cv::Mat& model, int from, int to, cv::uint64 seed );
+	void attach_samples();
+	void refresh_border( bool fold );
+	uchar* sample_ptr( int row, int col ){	return samples.ptr<uchar>(row + NEIGHBOR_RANGE) + (col + NEIGHBOR_RANGE)*N*samples.elemSize();	}
+	void classify_row( int row, int from, int step );
+	template<int CN, bool CHROMA> void process_row( int row, int from, int step );
+	bool split_planes( const cv::Mat& frame, cv::Mat& luma );
+	// UV samples of the 2x2 block of luma pixel (row, col)
+	uchar* chroma_ptr( int row, int col ){	return chroma_samples.ptr<uchar>(row/2 + NEIGHBOR_RANGE) + (col/2 + NEIGHBOR_RANGE)*N*2;	}
+	int getChromaDist( int row, int col, int index );
+	void update_chroma( int row, int col, int index );
+	void collect_init_frame( const cv::Mat& img );
+	void begin_init_frame();
+	void end_init_frame( const cv::Mat& img );
+
+	// real-time mode
+	double frame_budget;	// in ms, 0 means disabled
+	int fill_mode;
+	int degradation;
+	int pinned_degradation;	// -1 when the budget chooses the level
+	double processed_ratio;
+	double pixel_cost;		// estimated classification time per pixel in ms
+	double blob_cost;		// estimated findBlobs time in ms
+	long budget_frame;		// rotates the pixel subsets between frames
+	std::vector<int> row_phase;	// per row of the last frame: -2 skipped, -1 all pixels, 0/1 checkerboard phase
+
+	int choose_degradation()	const;
+	void process_budgeted();
+	void fill_skipped();
 
 	cv::Point getRandomNeighbor(int row, int col);
 
-	float getDist(cv::Mat &img, cv::Mat &sample, int row, int col, int index);
+	float getDist(cv::Mat &img, cv::Mat &sample, int row, int col, int index);	// sample has the layout of samples
 	
 	// find connected area and return the bounding rectangle
 	void findBlobs();	
-	std::vector<std::vector<cv::Point2i> >& findRotatedBlobs(const cv::Mat &binary, std::vector <cv::RotatedRect> &rot_blobs);
-	static bool rect_larger_than( const cv::Rect& r1, const cv::Rect& r2 ){	return (r1.area() > r2.area());	}
+	void begin_labels( const BitMask& bits, BlobSet& set );
+	void label_rows(int from, int to);
+	void end_labels();
+	void finish_blob(int root);
+	int find_root(int run);
 };
 
 
@@ -2,9 +2,15 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #include "ViBe.h"
 #include "trajDebugger.h"
+#include "maskStream.h"
+#include "shmRing.h"
+#include "blobTracker.h"
+#include "frameSource.h"
+#include "chunkProcessor.h"
 
 #include <iostream>
 #include <string>
+#include <deque>
 #include <stdlib.h>
 #include <unistd.h>
 #include <ctime>
@@ -13,11 +19,24 @@
  * Input parameters:
  *  -o <out_sample_name>: output background sample NAME
  *  -v <out_video_name>: output forground video NAME
+ *  -w <out_mask_name>: output run-length encoded masks NAME, blobs go to NAME.jsonl
+ *  -p <shm_name>: publish masks and blobs to the shared memory ring NAME
+ *  -t <out_traj_name>: track the blobs and write their trajectories to NAME
  *  -s <sample_path>: pre-run background sample PATH
- *  -i <input_video_path>: input video PATH
+ *  -i <input_video_path>: input video PATH, .y4m .yuv .gray .bgr files are read raw
+ *  -y <width>x<height>: frame size of a raw .yuv/.gray/.bgr input
  *  -f <frame number>: number of frame to process
  *	-r: flag indicating backwards processing
  *	-m: no display
+ *	-n <frame number>: number of first frames used to initialize the background model
+ *	-l <milliseconds>[:n]: per frame latency budget, process a subset of pixels when at risk.
+ *		The skipped pixels keep their last classification, with :n they copy a processed neighbor
+ *	-d <k>: process one of k frames, the others are only grabbed, never retrieved
+ *	-e <y|c>: classify planar YUV 4:2:0 frames, on luma only (y) or on luma and chroma (c)
+ *	-k <chunks>: offline mode, process the video in this many time chunks in parallel, needs -w
+ *	-u <frame number>: warm-up frames before every chunk, with -b a backward pass over them
+ *	-j: label the blobs of a frame on a second thread while the next frame is classified,
+ *	    the boxes drawn are then those of the previous frame
  *
  * Generated Images:
  *  
@@ -31,12 +50,23 @@ struct Options{
     Options():
         write_samples(false),
         write_video(false),
+        write_masks(false),
         use_samples(false),
 		backwards(false),
 		display(true),
 		drawCountour(false),
 		resize_factor(1),
 		to_frame_num(-1),
+		init_frames(1),
+		raw_width(0),
+		raw_height(0),
+		frame_budget(0),
+		fill_neighbor(false),
+		decimation(1),
+		yuv_mode(-1),
+		chunks(1),
+		warm_up(100),
+		pipelined(false),
         out_samples_name(),
         out_video_name(),
         in_samples_name(),
@@ -44,14 +74,27 @@ struct Options{
     {}
     bool write_samples;	// whether to write samples files
     bool write_video;	// whether to write videos 
+    bool write_masks;	// whether to write compressed masks and blobs
     bool use_samples;	// whether to use prerunning samples
 	bool backwards;
 	bool display;
 	bool drawCountour;
 	double resize_factor;
 	int to_frame_num;
+	int init_frames;	// number of first frames to initialize the model with
+	int raw_width, raw_height;	// frame size of raw input files, 0 to take it from the name
+	double frame_budget;	// latency budget per frame in ms, 0 to process every pixel
+	bool fill_neighbor;		// skipped pixels copy a processed neighbor, see FILL_NEIGHBOR
+	int decimation;		// process one of decimation frames
+	int yuv_mode;		// -1 for BGR/gray frames, 0 planar luma only, 1 planar luma and chroma
+	int chunks;			// time chunks processed in parallel, 1 for the usual sequential run
+	int warm_up;		// warm-up frames of every chunk
+	bool pipelined;		// blobs labelled on a second thread, see ViBe::setPipelined
     string out_samples_name;
     string out_video_name;
+    string out_mask_name;
+    string shm_name;	// shared memory ring to publish to, empty for none
+    string out_traj_name;	// trajectories of the tracked blobs, empty for none
     string in_samples_name;
     string video_name;
 	string gt_path;
@@ -59,11 +102,17 @@ struct Options{
 
 void print_help(){
     cout << "Usage: ./ViBe [-o output samples file] "
-        << "[-v output video file name] [-s prerunning samples file path] "
-        << "[-i Video file path] [-g ground truth path]"
+        << "[-v output video file name] [-w output mask file name] [-p shared memory name] [-t output trajectory file] [-s prerunning samples file path] "
+        << "[-i Video file path] [-y raw frame size WxH] [-g ground truth path]"
 		<< "[-f number of frame to process] [-r resize_factor]"
 		<< "[-m disable display during processing] "
 		<< "[-b backwards processing] "
+		<< "[-n number of frames to initialize the model] "
+		<< "[-l latency budget per frame in ms, :n to fill skipped pixels from neighbors] "
+		<< "[-d process one of d frames] "
+		<< "[-e planar YUV on luma (y) or luma and chroma (c)] "
+		<< "[-k number of chunks processed in parallel] [-u warm-up frames per chunk] "
+		<< "[-j pipelined blob labelling] "
         << endl;
 
 }
@@ -75,11 +124,14 @@ void parse_command_line( int argc, char** argv, Options& o ){
         exit(0);
     }
 
-    while( ( c = getopt(argc, argv, "i:s:v:g:o:f:r:cbm")) != -1 ){
+    while( ( c = getopt(argc, argv, "i:y:s:v:w:p:t:g:o:f:r:n:l:d:e:k:u:cbmj")) != -1 ){
         switch(c){
 			case 'i':
 				o.video_name = optarg;
 				break;
+			case 'y':
+				sscanf(optarg, "%dx%d", &o.raw_width, &o.raw_height);
+				break;
 			// output sample name
             case 'o':
                 o.write_samples = true;
@@ -93,6 +145,19 @@ void parse_command_line( int argc, char** argv, Options& o ){
             case 'v':
                 o.write_video = true;
                 o.out_video_name = optarg;
+                break;
+			// output compressed mask file name
+            case 'w':
+                o.write_masks = true;
+                o.out_mask_name = optarg;
+                break;
+			// shared memory ring to publish to
+            case 'p':
+                o.shm_name = optarg;
+                break;
+			// output trajectory file name
+            case 't':
+                o.out_traj_name = optarg;
                 break;
 			// output sample file name
             case 's':
@@ -106,6 +171,25 @@ void parse_command_line( int argc, char** argv, Options& o ){
 			case 'f':
 				o.to_frame_num = atoi(optarg);
 				break;
+			case 'n':
+				o.init_frames = atoi(optarg);
+				break;
+			case 'l':
+				o.frame_budget = atof(optarg);
+				o.fill_neighbor = string(optarg).find(":n") != string::npos;
+				break;
+			case 'd':
+				o.decimation = std::max(1, atoi(optarg));
+				break;
+			case 'e':
+				o.yuv_mode = optarg[0] == 'c' ? 1 : 0;
+				break;
+			case 'k':
+				o.chunks = std::max(1, atoi(optarg));
+				break;
+			case 'u':
+				o.warm_up = std::max(0, atoi(optarg));
+				break;
 			case 'b':
 				o.backwards = true;
 				break;
@@ -115,6 +199,9 @@ void parse_command_line( int argc, char** argv, Options& o ){
 			case 'm':
 				o.display = false;
 				break;
+			case 'j':
+				o.pipelined = true;
+				break;
             default:
                 print_help();
                 break;
@@ -126,31 +213,69 @@ void parse_command_line( int argc, char** argv, Options& o ){
             :"No pre-running sample") << o.in_samples_name << endl;
     cout << (o.write_samples? "Write samples: ": "No output samples") << o.out_samples_name << endl;
     cout << (o.write_video? "Write to video: ": "No output video") << o.out_video_name << endl;
+    cout << (o.write_masks? "Write masks: ": "No output masks") << o.out_mask_name << endl;
+    cout << (o.shm_name.empty()? "No shared memory": "Publish to shared memory: ") << o.shm_name << endl;
 	cout << (o.backwards ? "Run video backwardsly.\n" : "");
 	cout << "============================================================================" << endl;
 }
 
+// offline mode: only the masks and blobs are written, -b gives the chunks a backward warm-up
+int run_chunks( const Options& o ){
+	if(!o.write_masks){
+		cout << "chunked processing writes its results with -w, no mask file given" << endl;
+		return -1;
+	}
+	// the chunks only produce the mask stream
+	if(o.write_video || o.write_samples || o.use_samples || !o.shm_name.empty() || !o.out_traj_name.empty()
+			|| !o.gt_path.empty() || o.frame_budget > 0 || o.pipelined){
+		cout << "chunked processing only writes -w, it cannot be combined with -v -o -s -p -t -g -l -j" << endl;
+		return -1;
+	}
+	ChunkProcessor processor(o.chunks, o.warm_up, o.backwards);
+	processor.setDecimation(o.decimation);
+	if(o.yuv_mode >= 0)
+		processor.setPlanar(o.yuv_mode == 1);
+	processor.setSetup([&o](ViBe& vb){	vb.setInitFrames(o.init_frames);	});
+	bool ok = processor.run(o.video_name, o.out_mask_name, o.to_frame_num, o.raw_width, o.raw_height);
+	processor.report(cout);
+	cout << "==========finished===========" << endl;
+	return ok ? 0 : -1;
+}
 
 int main(int argc, char **argv)
 {
-    VideoCapture cap;
+    FrameSource cap;
     VideoWriter record;
+    MaskWriter mask_writer;
+    ShmPublisher publisher;
+    BlobTracker tracker;
 	TrajDebugger debugger;
 	bool gt_successful = false;
 
     Options o;
     parse_command_line(argc, argv, o);
 
+	if(o.chunks > 1)
+		return run_chunks(o);
+
 	if(!o.gt_path.empty())	gt_successful = debugger.readGroundTruthFromFile(o.gt_path);
 
     cout << "Open video " << o.video_name << endl;
-    if( !cap.open(o.video_name) ){
+    if( !cap.open(o.video_name, o.raw_width, o.raw_height) ){
         cout << "Failed to open the video" << o.video_name << " , exiting..." << endl;
         return -1;
     }
 
     ViBe vb;
-    Mat frame, fore, mask;
+	vb.setInitFrames(o.init_frames);
+	vb.setFrameBudget(o.frame_budget, o.fill_neighbor ? FILL_NEIGHBOR : FILL_PREVIOUS);
+	vb.setDecimation(o.decimation);
+	cap.setPlanar(o.yuv_mode >= 0);
+	if(o.yuv_mode >= 0)
+		vb.setInput(cap.getPlanarFormat() == RAW_NV12 ? INPUT_NV12 : INPUT_I420, o.yuv_mode == 1);
+    Mat frame, fore;
+	// output buffers reused from frame to frame
+	Mat match_mask, fore_bgr, scaled_fore, scaled_frame, frame_bgr;
 
     int width = cap.get(CAP_PROP_FRAME_WIDTH);
     int height = cap.get(CAP_PROP_FRAME_HEIGHT);
@@ -159,6 +284,38 @@ int main(int argc, char **argv)
     cout << "total " << frames << " frames" << endl;
     //int fourcc = int(cap.get(CAP_PROP_FOURCC));
 
+	// masks and blobs are stored losslessly, before any drawing or resizing
+	auto output_blobs = [&](int id, const BitMask& bits, const Mat& fore_mask, const BlobSet& blobs){
+		if(o.write_masks){
+			if(!mask_writer.isOpened() && !mask_writer.open(o.out_mask_name, bits.getWidth(), bits.getHeight())){
+				cout << "Failed to open the mask writer" << endl;
+				return false;
+			}
+			mask_writer.write(id, bits, blobs.getBBoxes(), blobs.getRotBboxes());
+		}
+		if(!o.shm_name.empty()){
+			if(!publisher.isOpened() && !publisher.open(o.shm_name, bits.getWidth(), bits.getHeight())){
+				cout << "Failed to open the shared memory ring" << endl;
+				return false;
+			}
+			publisher.publish(id, fore_mask, blobs.getBBoxes(), blobs.getRotBboxes());
+		}
+		if(!o.out_traj_name.empty())
+			tracker.update(id, blobs.getBBoxes());
+		return true;
+	};
+	// pipelined, the blobs of a frame come out during the next process call, in frame order
+	deque<int> frame_ids;
+	Mat blob_fore;
+	bool output_failed = false;
+	if(o.pipelined)
+		vb.setPipelined([&](long, const BitMask& bits, const BlobSet& blobs){
+			if(!o.shm_name.empty())
+				bits.toMat(blob_fore, COLOR_FOREGROUND);
+			output_failed = !output_blobs(frame_ids.front(), bits, blob_fore, blobs) || output_failed;
+			frame_ids.pop_front();
+		}, o.write_masks || !o.shm_name.empty());
+
 	Mat big_frame(height, width*2, CV_8UC3);
     vector<vector<Point> > countours;
     vector<Vec4i> hierarchy;
@@ -170,6 +327,14 @@ int main(int argc, char **argv)
     for(int i = 0; i < o.to_frame_num;)	
     {
         if( i == 0 || play ){
+			// skipped frames are grabbed, not retrieved: raw files just move on, VideoCapture
+			// still decodes them but saves the conversion and the copy
+			if( i > 0 && !o.backwards ){
+				for(int d = 1; d < o.decimation && i < o.to_frame_num; d++, i++)
+					cap.grab();
+				if( i >= o.to_frame_num )
+					break;
+			}
             cap >> frame;
 			++i;
             cout << "=========== " << o.video_name << " frame " << cap.get(CV_CAP_PROP_POS_FRAMES) 
@@ -179,30 +344,48 @@ int main(int argc, char **argv)
 
 			const clock_t begin_time = clock();
             if(vb.process(frame, fore, o.in_samples_name)){
+				if(o.pipelined)
+					frame_ids.push_back(i);
+				if(output_failed)
+					return -1;
 				std::cout << float( clock () - begin_time ) /  CLOCKS_PER_SEC << "\t";	
+				if(o.frame_budget > 0)
+					std::cout << "degradation " << vb.getDegradation() << "\t";
                 //erode(fore,fore,Mat());
                 //dilate(fore,fore,Mat());
-                vb.getMask(fore, mask, false);
+				if(!o.pipelined && !output_blobs(i, vb.getForegroundBits(), fore, vb.getBlobs()))
+					return -1;
 				// mark corect/incorrect pixels
 				if(gt_successful) {
-					Mat matchMask;
-					debugger.GTForeMask(frame, fore, i, Scalar(0, 255, 0), Scalar(0, 0, 255), matchMask);
-					addWeighted(frame,0.6,matchMask,0.4,0, frame);
+					// planar frames and the luma views of raw files are only converted to be drawn on
+					if(o.yuv_mode >= 0){
+						cvtColor(frame, frame_bgr, cap.getPlanarFormat() == RAW_NV12 ? COLOR_YUV2BGR_NV12 : COLOR_YUV2BGR_I420);
+						frame = frame_bgr;
+					}else if(frame.channels() == 1){
+						cvtColor(frame, frame_bgr, COLOR_GRAY2BGR);
+						frame = frame_bgr;
+					}
+					debugger.GTForeMask(frame, fore, i, Scalar(0, 255, 0), Scalar(0, 0, 255), match_mask);
+					addWeighted(frame,0.6,match_mask,0.4,0, frame);
 				}
 
-				cvtColor(fore, fore, COLOR_GRAY2BGR);
+				// fore stays the 1-channel mask, the color and resized versions go to their own buffers
+				cvtColor(fore, fore_bgr, COLOR_GRAY2BGR);
+				Mat view_fore = fore_bgr, view_frame = frame;
 				
 				if(o.resize_factor != 1) {
-					cv::resize(fore, fore, cv::Size(0, 0), o.resize_factor, o.resize_factor);
-					cv::resize(frame, frame, cv::Size(0, 0), o.resize_factor, o.resize_factor);
+					cv::resize(fore_bgr, scaled_fore, cv::Size(0, 0), o.resize_factor, o.resize_factor);
+					cv::resize(frame, scaled_frame, cv::Size(0, 0), o.resize_factor, o.resize_factor);
+					view_fore = scaled_fore;
+					view_frame = scaled_frame;
 				}
 
                 //vb.getMaskedImg(frame, fore);   
-				vector<Rect> boxes = vb.getBBoxes();
-				for(Rect b : boxes) {
+				const vector<Rect>& boxes = vb.getBBoxes();
+				for(const Rect& b : boxes) {
 					//rectangle(frame, Rect(b.tl()*o.resize_factor, b.br()*o.resize_factor), Scalar(0, 255, 0), std::max(1.0,o.resize_factor));
 					if(o.drawCountour)
-						rectangle(fore, Rect(b.tl()*o.resize_factor, b.br()*o.resize_factor), Scalar(0, 255, 0), std::max(1.0,o.resize_factor));
+						rectangle(view_fore, Rect(b.tl()*o.resize_factor, b.br()*o.resize_factor), Scalar(0, 255, 0), std::max(1.0,o.resize_factor));
 				}	
 				//Mat roi = big_frame(Rect(0, 0, width, height));
 				//frame.copyTo(roi);
@@ -223,9 +406,9 @@ int main(int argc, char **argv)
                     }
 
 					if(gt_successful)	
-						record.write(frame);
+						record.write(view_frame);
 					else	
-						record.write(fore);
+						record.write(view_fore);
 					//record.write(big_frame);
                 }
 
@@ -235,7 +418,7 @@ int main(int argc, char **argv)
 				//}
 
 				if(o.display){
-					imshow("foreground", fore);
+					imshow("foreground", view_fore);
 					//imshow("mask", mask);
 					//imshow("frame", frame);
 					//imshow("big_frame", big_frame);
@@ -243,7 +426,8 @@ int main(int argc, char **argv)
             }
 
 			if(o.backwards){
-				cap.set(CV_CAP_PROP_POS_FRAMES, cap.get(CV_CAP_PROP_POS_FRAMES)-2);	// set next frame to be the previous frame
+				cap.set(CV_CAP_PROP_POS_FRAMES, cap.get(CV_CAP_PROP_POS_FRAMES)-1-o.decimation);	// set next frame to be the previous frame
+				i += o.decimation-1;
 			}
         }
 
@@ -256,10 +440,16 @@ int main(int argc, char **argv)
 		}
     }
 
+	vb.flushBlobs();
+	if(output_failed)
+		return -1;
     cout << "==========finished===========" << endl;
     if(o.write_samples)
         vb.saveSamplesToFile( o.out_samples_name );
 
+    mask_writer.close();
+    if(!o.out_traj_name.empty())
+        tracker.writeTrajectories(o.out_traj_name);
     cap.release();
     return 0;
 }
@@ -0,0 +1,631 @@
+#include <opencv2/opencv.hpp>
+#include "ViBe.h"
+#include "maskStream.h"
+#include "chunkProcessor.h"
+#include "shmRing.h"
+#include "blobTracker.h"
+#include "trajDebugger.h"
+
+#include <iostream>
+#include <functional>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <fstream>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <unistd.h>
+
+/*
+ * Golden output harness for the ViBe kernels.
+ *
+ * Every sequence is run with the reference kernel (pixel_process on every pixel) and then
+ * with every other variant, always from the same seed.
+ *  - exact variants draw the same random numbers in the same order: foreground masks,
+ *    blobs and the final sample model must be bit identical to the reference
+ *  - statistical variants have a different random schedule: their foreground ratio and
+ *    F-measure against the ground truth must not be worse than the reference by more
+ *    than a tolerance
+ * Planar YUV variants run on the color sequences converted to I420/NV12, an exact one is
+ * compared with the reference kernel given the same planes.
+ * The other checks:
+ *  - burst initialization run twice from the same seed gives the same output
+ *  - the masks survive MaskWriter/MaskReader and the shared memory ring unchanged
+ *  - replaying frames already seen does not allocate, neither pooled buffers nor anything
+ *    through operator new, which this program replaces to count the heap allocations
+ *  - pipelined frames keep their own foreground and blobs when frames without blobs
+ *    are processed in between
+ *  - the bit mask operations match their byte counterparts on the masks
+ *  - the neighbor fill of the real-time mode, at every pinned degradation level, matches
+ *    a byte by byte fill of the mask left by FILL_PREVIOUS
+ *  - the boxes of one object of the synthetic sequences keep their track id, and the
+ *    trajectories written read back as ground truth
+ *  - gray sequences through the chunk-parallel offline mode score like a statistical variant
+ *
+ * Usage: ViBe_test [video ...]
+ *  synthetic gray and color sequences with ground truth are always run, recorded videos
+ *  given on the command line are run with the exact variants only.
+ */
+
+using namespace std;
+using namespace cv;
+
+#define TEST_SEED 12345
+#define WARM_UP_FRAMES 10	// frames ignored by the statistical comparison
+#define F_TOLERANCE 0.05
+#define RATIO_TOLERANCE 0.02
+
+// every C++ heap allocation of the program, from any thread
+static std::atomic<unsigned long> heap_allocations(0);
+
+void* operator new(size_t size){
+	heap_allocations++;
+	if(void* p = malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept{
+	free(p);
+}
+
+struct Sequence{
+	string name;
+	vector<Mat> frames;
+	vector<Mat> truth;	// empty for recorded videos
+};
+
+struct Run{
+	vector<Mat> masks;
+	vector<vector<Rect> > bboxes;
+	vector<vector<RotatedRect> > rot_bboxes;
+	Mat samples;
+};
+
+struct Variant{
+	string name;
+	function<void(ViBe&)> setup;
+	bool exact;
+	int input;	// layout the frames are converted to, INPUT_PACKED if omitted
+	int band_rows;	// frames are streamed in bands of that many rows, whole frames if omitted
+	bool pipelined;	// blobs labelled on the pipeline thread and collected from the callback
+};
+
+static int failures = 0;
+
+static void check(bool ok, const string& what){
+	cout << (ok ? "[ OK ] " : "[FAIL] ") << what << endl;
+	if(!ok)	failures++;
+}
+
+// textured background with noise, three boxes sliding in from the borders after the initialization frames
+static Sequence syntheticSequence(const string& name, int type, int frames){
+	const int width = 160, height = 120;
+	Sequence seq;
+	seq.name = name;
+
+	RNG rng(TEST_SEED);
+	Mat background(height, width, type);
+	for(int i = 0; i < height; i++){
+		uchar* row = background.ptr<uchar>(i);
+		for(int j = 0; j < width*background.channels(); j++)
+			row[j] = 40 + (i + j/background.channels())/6 + rng.uniform(0, 20) + 10*(j%background.channels());
+	}
+
+	const Rect boxes[3] = {Rect(-60, 20, 24, 18), Rect(width+20, 60, 20, 26), Rect(50, -70, 30, 16)};
+	const Point speed[3] = {Point(3, 0), Point(-2, 1), Point(1, 2)};
+	const Scalar colors[3] = {Scalar(220, 200, 230), Scalar(250, 180, 210), Scalar(200, 240, 190)};
+
+	for(int f = 0; f < frames; f++){
+		Mat frame = background.clone(), truth = Mat::zeros(height, width, CV_8UC1);
+		for(int b = 0; b < 3; b++){
+			Rect r = boxes[b] + speed[b]*f;
+			r &= Rect(0, 0, width, height);
+			if(r.area() == 0)	continue;
+			frame(r).setTo(colors[b]);
+			truth(r).setTo(COLOR_FOREGROUND);
+		}
+		// zero mean noise, added in float so that negative values are not lost
+		Mat noise(height, width, CV_32FC(frame.channels())), noisy;
+		rng.fill(noise, RNG::NORMAL, Scalar::all(0), Scalar::all(2));
+		frame.convertTo(noisy, CV_32F);
+		noisy += noise;
+		noisy.convertTo(frame, type);
+		seq.frames.push_back(frame);
+		seq.truth.push_back(truth);
+	}
+	return seq;
+}
+
+static bool recordedSequence(const string& path, int frames, Sequence& seq){
+	VideoCapture cap;
+	if(!cap.open(path))	return false;
+	seq.name = path;
+	Mat frame;
+	while((int)seq.frames.size() < frames && cap.read(frame))
+		seq.frames.push_back(frame.clone());
+	return !seq.frames.empty();
+}
+
+static Mat toPlanar(const Mat& bgr, int input){
+	Mat i420;
+	cvtColor(bgr, i420, COLOR_BGR2YUV_I420);
+	if(input == INPUT_I420)	return i420;
+	Mat nv12 = i420.clone();
+	const int quarter = bgr.rows*bgr.cols/4;
+	const uchar* u = i420.ptr<uchar>(bgr.rows), *v = u + quarter;
+	uchar* uv = nv12.ptr<uchar>(bgr.rows);
+	for(int i = 0; i < quarter; i++){
+		uv[2*i] = u[i];
+		uv[2*i+1] = v[i];
+	}
+	return nv12;
+}
+
+static Run runVariant(const Sequence& seq, const Variant& v){
+	Run run;
+	ViBe vb;
+	vb.setSeed(TEST_SEED);
+	v.setup(vb);
+
+	// the callback must see every frame once, in order
+	bool in_order = true;
+	if(v.pipelined)
+		vb.setPipelined([&run, &in_order](long frame, const BitMask& bits, const BlobSet& blobs){
+			in_order = in_order && frame == (long)run.masks.size();
+			Mat mask;
+			bits.toMat(mask, COLOR_FOREGROUND);
+			run.masks.push_back(mask);
+			run.bboxes.push_back(blobs.getBBoxes());
+			run.rot_bboxes.push_back(blobs.getRotBboxes());
+		}, true);
+
+	Mat fore;
+	for(const Mat& frame : seq.frames){
+		if(v.pipelined){
+			vb.process(frame);
+			continue;
+		}
+		if(v.band_rows > 0){
+			vb.beginFrame(frame.size(), frame.type());
+			for(int i = 0; i < frame.rows; i += v.band_rows)
+				vb.processRows(frame.rowRange(i, std::min(i + v.band_rows, frame.rows)));
+			vb.endFrame();
+			vb.getForeground(fore);
+		}else
+			vb.process(v.input == INPUT_PACKED ? frame : toPlanar(frame, v.input), fore);
+		run.masks.push_back(fore.clone());
+		run.bboxes.push_back(vb.getBBoxes());
+		run.rot_bboxes.push_back(vb.getRotBboxes());
+	}
+	if(v.pipelined){
+		vb.flushBlobs();
+		check(in_order && run.masks.size() == seq.frames.size(), seq.name + " / " + v.name + ": frames delivered in order");
+	}
+	run.samples = vb.getSamples().clone();
+	return run;
+}
+
+static bool sameMat(const Mat& a, const Mat& b){
+	if(a.dims != b.dims || a.type() != b.type() || a.total() != b.total())
+		return false;
+	return memcmp(a.data, b.data, a.total()*a.elemSize()) == 0;
+}
+
+static bool sameRotBoxes(const vector<RotatedRect>& a, const vector<RotatedRect>& b){
+	if(a.size() != b.size())	return false;
+	for(unsigned int i = 0; i < a.size(); i++)
+		if(a[i].center != b[i].center || a[i].size != b[i].size || a[i].angle != b[i].angle)
+			return false;
+	return true;
+}
+
+static void compareExact(const Sequence& seq, const Run& ref, const Run& run, const string& name){
+	if(run.masks.size() != ref.masks.size()){
+		check(false, seq.name + " / " + name + ": " + to_string(run.masks.size()) + " of " + to_string(ref.masks.size()) + " frames");
+		return;
+	}
+	int first_mask = -1, first_blob = -1;
+	for(unsigned int f = 0; f < ref.masks.size(); f++){
+		if(first_mask < 0 && !sameMat(ref.masks[f], run.masks[f]))
+			first_mask = f;
+		if(first_blob < 0 && (ref.bboxes[f] != run.bboxes[f] || !sameRotBoxes(ref.rot_bboxes[f], run.rot_bboxes[f])))
+			first_blob = f;
+	}
+	check(first_mask < 0, seq.name + " / " + name + ": masks" + (first_mask < 0 ? "" : " differ from frame " + to_string(first_mask)));
+	check(first_blob < 0, seq.name + " / " + name + ": blobs" + (first_blob < 0 ? "" : " differ from frame " + to_string(first_blob)));
+	check(sameMat(ref.samples, run.samples), seq.name + " / " + name + ": sample model");
+}
+
+// foreground ratio and F-measure against the ground truth after the warm up
+static void score(const Sequence& seq, const Run& run, double& ratio, double& f_measure){
+	double tp = 0, fp = 0, fn = 0, fore = 0, total = 0;
+	for(unsigned int f = WARM_UP_FRAMES; f < run.masks.size(); f++){
+		Mat detected = run.masks[f] != 0, truth = seq.truth[f] != 0;
+		double both = countNonZero(detected & truth);
+		tp += both;
+		fp += countNonZero(detected) - both;
+		fn += countNonZero(truth) - both;
+		fore += countNonZero(detected);
+		total += detected.total();
+	}
+	ratio = total > 0 ? fore/total : 0;
+	f_measure = tp > 0 ? 2*tp/(2*tp + fp + fn) : 0;
+}
+
+static void compareStatistical(const Sequence& seq, const Run& ref, const Run& run, const string& name){
+	double ref_ratio, ref_f, ratio, f;
+	score(seq, ref, ref_ratio, ref_f);
+	score(seq, run, ratio, f);
+
+	double truth_ratio = 0;
+	for(unsigned int i = WARM_UP_FRAMES; i < seq.truth.size(); i++)
+		truth_ratio += countNonZero(seq.truth[i])/double(seq.truth[i].total());
+	truth_ratio /= std::max<int>(1, seq.truth.size() - WARM_UP_FRAMES);
+
+	char buf[256];
+	snprintf(buf, sizeof(buf), ": F-measure %.3f (reference %.3f), foreground ratio %.4f (reference %.4f, truth %.4f)",
+			f, ref_f, ratio, ref_ratio, truth_ratio);
+	check(f >= ref_f - F_TOLERANCE && fabs(ratio - truth_ratio) <= fabs(ref_ratio - truth_ratio) + RATIO_TOLERANCE,
+			seq.name + " / " + name + buf);
+}
+
+// masks written with MaskWriter must read back unchanged
+static void checkMaskStream(const Sequence& seq, const Run& ref){
+	const string file_name = "ViBe_test.vmask";
+	// every frame also gets a box whose values need all the digits of a float
+	vector<vector<RotatedRect> > rot_bboxes(ref.rot_bboxes);
+	for(unsigned int f = 0; f < rot_bboxes.size(); f++)
+		rot_bboxes[f].push_back(RotatedRect(Point2f(1523.2534f + f, 0.1f/3), Size2f(2/3.0f, 1e7f/7), -33.333332f));
+
+	MaskWriter writer;
+	bool ok = writer.open(file_name, ref.masks[0].cols, ref.masks[0].rows);
+	for(unsigned int f = 0; ok && f < ref.masks.size(); f++)
+		ok = writer.write(f, ref.masks[f], ref.bboxes[f], rot_bboxes[f]);
+	writer.close();
+
+	MaskReader reader;
+	ok = ok && reader.open(file_name) && reader.getFrameCount() == (int)ref.masks.size();
+	Mat mask;
+	vector<Rect> bboxes;
+	vector<RotatedRect> read_rot_bboxes;
+	for(unsigned int f = 0; ok && f < ref.masks.size(); f++)
+		ok = reader.read(f, mask, &bboxes, &read_rot_bboxes) && sameMat(mask, ref.masks[f]) && bboxes == ref.bboxes[f]
+			&& sameRotBoxes(read_rot_bboxes, rot_bboxes[f]);
+	reader.close();
+	remove(file_name.c_str());
+	remove((file_name + ".jsonl").c_str());
+	check(ok, seq.name + " / mask stream round trip");
+}
+
+// frames published to a small ring come out unchanged, a reader lapped by the publisher
+// skips to the oldest frame left and counts the others as dropped
+static void checkShmRing(const Sequence& seq, const Run& ref){
+	const string name = "vibe_test_" + to_string(getpid());
+	const int slots = 4, max_blobs = 1, n = ref.masks.size();
+	ShmPublisher publisher;
+	ShmSubscriber subscriber;
+	if(!publisher.open(name, ref.masks[0].cols, ref.masks[0].rows, slots, max_blobs) || !subscriber.open(name)){
+		check(false, seq.name + " / shared memory ring: open " + name);
+		return;
+	}
+
+	// the published frame f holds reference frame f % n, with id f + 1000
+	auto publish = [&](int f){	return publisher.publish(f + 1000, ref.masks[f % n], ref.bboxes[f % n], ref.rot_bboxes[f % n]);	};
+	auto same = [&](const ShmFrame& frame, int f){
+		const vector<Rect>& boxes = ref.bboxes[f % n];
+		const vector<RotatedRect>& rots = ref.rot_bboxes[f % n];
+		bool ok = (int)frame.seq == f && frame.frame_id == f + 1000 && sameMat(frame.mask, ref.masks[f % n])
+			&& frame.total_blobs == (int)boxes.size() && frame.blob_count == std::min<int>(boxes.size(), max_blobs);
+		for(int b = 0; ok && b < frame.blob_count; b++){
+			const ShmBlob& blob = frame.blobs[b];
+			ok = Rect(blob.x, blob.y, blob.width, blob.height) == boxes[b] && blob.cx == rots[b].center.x && blob.cy == rots[b].center.y
+				&& blob.rot_width == rots[b].size.width && blob.rot_height == rots[b].size.height && blob.angle == rots[b].angle;
+		}
+		return ok;
+	};
+
+	ShmFrame first, frame;
+	bool ok = publish(0) && subscriber.acquire(first) && same(first, 0) && subscriber.validate(first);
+	check(ok, seq.name + " / shared memory ring: publish and acquire");
+
+	// 10 more frames: the slot of the first frame is overwritten, the reader is lapped
+	for(int f = 1; ok && f <= 10; f++)
+		ok = publish(f);
+	check(ok && !subscriber.validate(first), seq.name + " / shared memory ring: overwritten frame fails validation");
+	int next = 11 - slots;
+	while(ok && subscriber.acquire(frame)){
+		ok = same(frame, next) && subscriber.validate(frame);
+		next++;
+	}
+	check(ok && next == 11 && subscriber.getDropped() == (uint64_t)(10 - slots),
+		seq.name + " / shared memory ring: lapped reader, " + to_string(subscriber.getDropped()) + " dropped");
+
+	subscriber.close();
+	publisher.close();
+}
+
+// the boxes of the reference run through the tracker: a box that clearly continues one box of
+// the previous frame, IoU of at least 0.5 both ways and with no other box, keeps its id.
+// The trajectories written must read back as ground truth with the same boxes and frames.
+static void checkTracker(const Sequence& seq, const Run& ref){
+	BlobTracker tracker;
+	vector<Rect> last_boxes;
+	vector<int> last_ids;
+	int continued = 0, kept = 0;
+	auto iou = [](const Rect& a, const Rect& b){	double i = (a & b).area();	return i/(a.area() + b.area() - i);	};
+	for(unsigned int f = 0; f < ref.bboxes.size(); f++){
+		const vector<Rect>& boxes = ref.bboxes[f];
+		const vector<int> ids = tracker.update(f + 1, boxes);
+		for(unsigned int b = 0; b < boxes.size(); b++){
+			int match = -1, matches = 0;
+			for(unsigned int p = 0; p < last_boxes.size(); p++)
+				if(iou(boxes[b], last_boxes[p]) >= 0.5){
+					match = p;
+					matches++;
+				}
+			if(matches != 1)	continue;
+			int reverse = 0;
+			for(unsigned int o = 0; o < boxes.size(); o++)
+				reverse += iou(boxes[o], last_boxes[match]) >= 0.5;
+			if(reverse != 1)	continue;
+			continued++;
+			kept += ids[b] == last_ids[match];
+		}
+		last_boxes = boxes;
+		last_ids = ids;
+	}
+	check(continued > 0 && kept == continued, seq.name + " / tracker: " + to_string(kept) + " of " + to_string(continued) + " continued boxes keep their id");
+
+	const string file_name = "ViBe_test_tracks.txt";
+	map<int, TrajVec> tracks;
+	tracker.getTrajectories(tracks);
+	TrajDebugger reader;
+	bool ok = tracker.writeTrajectories(file_name) && reader.readGroundTruthFromFile(file_name);
+	const map<int, TrajVec>& read = reader.getGroundTruth();
+	ok = ok && read.size() == tracks.size();
+	for(auto t = tracks.cbegin(), r = read.cbegin(); ok && t != tracks.cend(); ++t, ++r){
+		ok = t->first == r->first && t->second.size() == r->second.size();
+		for(unsigned int u = 0; ok && u < t->second.size(); u++)
+			ok = t->second[u].frame_id == r->second[u].frame_id && t->second[u].box == r->second[u].box;
+	}
+	remove(file_name.c_str());
+	check(ok, seq.name + " / tracker: trajectories read back");
+}
+
+// word operations of BitMask against OpenCV on bytes, on the reference masks and on noise
+static void checkBitMask(const Sequence& seq, const Run& ref){
+	RNG rng(TEST_SEED);
+	Mat noise(ref.masks[0].size(), CV_8UC1);
+	rng.fill(noise, RNG::UNIFORM, 0, 2);
+	vector<Mat> masks(ref.masks);
+	masks.push_back(noise > 0);
+
+	bool ok = true;
+	BitMask bits, other, result;
+	Mat back, expected;
+	vector<uint8_t> byte_runs, bit_runs;
+	const Rect roi(13, 7, 97, 50);
+	for(unsigned int i = 0; ok && i < masks.size(); i++){
+		const Mat& m = masks[i];
+		bits.fromMat(m);
+		bits.toMat(back);
+		ok = ok && sameMat(back, m) && bits.count() == countNonZero(m) && bits.count(roi) == countNonZero(m(roi));
+
+		bits.dilate(result);
+		result.toMat(back);
+		dilate(m, expected, Mat());
+		ok = ok && sameMat(back, expected);
+		bits.erode(result);
+		result.toMat(back);
+		erode(m, expected, Mat());
+		ok = ok && sameMat(back, expected);
+
+		const Mat& previous = masks[i > 0 ? i-1 : masks.size()-1];
+		other.fromMat(previous);
+		other.intersect(bits);
+		other.toMat(back);
+		ok = ok && sameMat(back, previous & m);
+
+		MaskWriter::encodeRuns(m, byte_runs);
+		MaskWriter::encodeRuns(bits, bit_runs);
+		ok = ok && byte_runs == bit_runs;
+	}
+	check(ok, seq.name + " / bit mask operations");
+}
+
+// the sequence is written to a raw file, processed in 3 chunks and read back from the stitched stream
+static void checkChunks(const Sequence& seq, const Run& ref){
+	const int n = seq.frames.size(), width = seq.frames[0].cols, height = seq.frames[0].rows;
+	const string video_name = "ViBe_test_" + to_string(width) + "x" + to_string(height) + ".gray";
+	const string mask_name = "ViBe_test_chunks.vmask";
+	ofstream video(video_name.c_str(), ios::binary);
+	for(const Mat& frame : seq.frames)
+		for(int i = 0; i < height; i++)
+			video.write((const char*)frame.ptr<uchar>(i), width);
+	video.close();
+
+	ChunkProcessor processor(3, 15);
+	processor.setSetup([](ViBe& vb){	vb.setSeed(TEST_SEED);	});
+	bool ok = processor.run(video_name, mask_name);
+
+	Run run;
+	MaskReader reader;
+	ok = ok && reader.open(mask_name) && reader.getFrameCount() == n;
+	Mat mask;
+	for(int f = 0; ok && f < n; f++){
+		ok = reader.read(f, mask) && reader.getFrameId(f) == f+1;
+		run.masks.push_back(mask.clone());
+	}
+	reader.close();
+	remove(video_name.c_str());
+	remove(mask_name.c_str());
+	remove((mask_name + ".jsonl").c_str());
+	check(ok, seq.name + " / chunked stream: " + to_string(n) + " frames in order");
+	if(ok)
+		compareStatistical(seq, ref, run, "chunked offline processing");
+}
+
+// with the degradation level pinned, FILL_NEIGHBOR must give the FILL_PREVIOUS mask of the same
+// seed with every skipped pixel filled byte by byte: a skipped column of a checkerboard row
+// copies its left neighbor, or its right one at column 0, a skipped row copies the nearest
+// processed row, the upper one first. The fill does not touch the model, both runs stay in step.
+static void checkFillNeighbor(const Sequence& seq){
+	for(int level = 1; level <= MAX_DEGRADATION; level++){
+		ViBe previous, neighbor;
+		previous.setSeed(TEST_SEED);
+		neighbor.setSeed(TEST_SEED);
+		previous.setFrameBudget(0, FILL_PREVIOUS);
+		neighbor.setFrameBudget(0, FILL_NEIGHBOR);
+		previous.setDegradation(level);
+		neighbor.setDegradation(level);
+		Mat prev_fore, fore, expected;
+		int first_bad = -1;
+		for(unsigned int f = 0; f < seq.frames.size(); f++){
+			previous.process(seq.frames[f], prev_fore, "", false);
+			neighbor.process(seq.frames[f], fore, "", false);
+			if(f == 0 || first_bad >= 0)
+				continue;
+			const vector<int>& phase = previous.getRowPhases();
+			if(phase != neighbor.getRowPhases() || neighbor.getDegradation() != level){
+				first_bad = f;
+				continue;
+			}
+			expected = prev_fore.clone();
+			const int rows = expected.rows, cols = expected.cols;
+			for(int i = 0; i < rows; i++){
+				if(phase[i] < 0)	continue;
+				uchar* row = expected.ptr<uchar>(i);
+				for(int j = 0; j < cols; j++)
+					if((j & 1) != phase[i])
+						row[j] = j > 0 ? row[j-1] : (cols > 1 ? row[1] : row[0]);
+			}
+			for(int i = 0; i < rows; i++){
+				if(phase[i] != -2)	continue;
+				for(int d = 1; d < rows; d++){
+					int src = (i-d >= 0 && phase[i-d] != -2) ? i-d : (i+d < rows && phase[i+d] != -2) ? i+d : -1;
+					if(src >= 0){
+						expected.row(src).copyTo(expected.row(i));
+						break;
+					}
+				}
+			}
+			if(!sameMat(expected, fore))
+				first_bad = f;
+		}
+		check(first_bad < 0, seq.name + " / neighbor fill at degradation " + to_string(level)
+			+ (first_bad < 0 ? "" : ": differs from frame " + to_string(first_bad)));
+	}
+}
+
+// frames processed without blobs between pipelined ones are not given to the callback,
+// every pipelined frame still comes with its own foreground and blobs
+static void checkPipelineGaps(const Sequence& seq, const Run& ref){
+	ViBe vb;
+	vb.setSeed(TEST_SEED);
+	vector<long> delivered;
+	bool same = true;
+	vb.setPipelined([&](long frame, const BitMask& bits, const BlobSet& blobs){
+		Mat mask;
+		bits.toMat(mask, COLOR_FOREGROUND);
+		delivered.push_back(frame);
+		same = same && sameMat(mask, ref.masks[frame]) && blobs.getBBoxes() == ref.bboxes[frame];
+	});
+	vector<long> expected;
+	for(unsigned int f = 0; f < seq.frames.size(); f++){
+		bool blobs = f % 3 != 1;
+		vb.process(seq.frames[f], "", blobs);
+		if(blobs)
+			expected.push_back(f);
+	}
+	vb.flushBlobs();
+	check(same && delivered == expected, seq.name + " / pipelined frames between frames without blobs");
+}
+
+// once a sequence has been seen, running part of it again must not allocate: classification,
+// labelling, the byte foreground, the boxes and the pixel lists, also with the labelling on
+// the pipeline thread. Contours and rotated boxes are left out, the OpenCV routines
+// computing them allocate internally.
+static void checkSteadyAllocations(const Sequence& seq, bool pipelined){
+	ViBe vb;
+	vb.setSeed(TEST_SEED);
+	if(pipelined)
+		vb.setPipelined([](long, const BitMask&, const BlobSet& blobs){	blobs.getPixels();	});
+	Mat fore;
+	unsigned long warm = 0, warm_heap = 0;
+	int n = seq.frames.size(), replay = n/3;
+	for(int f = 0; f < n + replay; f++){
+		if(f == n){
+			warm = vb.getAllocationCount();
+			warm_heap = heap_allocations;
+		}
+		vb.process(seq.frames[f < n ? f : f - replay], fore);
+		vb.getBBoxes();
+		vb.getBlobs().getPixels();
+	}
+	vb.flushBlobs();
+	unsigned long extra = vb.getAllocationCount() - warm, heap = heap_allocations - warm_heap;
+	check(extra == 0 && heap == 0, seq.name + " / steady state allocations" + (pipelined ? ", pipelined: " : ": ")
+		+ to_string(extra) + " pooled, " + to_string(heap) + " heap");
+}
+
+int main(int argc, char** argv){
+	const Variant reference = {"reference", [](ViBe& vb){	vb.setKernel(KERNEL_REFERENCE);	}, true};
+	const vector<Variant> variants = {
+		{"row kernel", [](ViBe& vb){	vb.setKernel(KERNEL_ROW);	}, true},
+		// a budget that is never at risk must not change anything
+		{"row kernel, relaxed frame budget", [](ViBe& vb){	vb.setFrameBudget(1e6);	}, true},
+		{"reference, other seed", [](ViBe& vb){	vb.setKernel(KERNEL_REFERENCE);	vb.setSeed(TEST_SEED+1);	}, false},
+		{"burst initialization", [](ViBe& vb){	vb.setInitFrames(5);	}, false},
+		{"I420 luma only", [](ViBe& vb){	vb.setInput(INPUT_I420);	}, false, INPUT_I420},
+		{"I420 luma and chroma", [](ViBe& vb){	vb.setInput(INPUT_I420, true);	}, false, INPUT_I420},
+		{"NV12 luma and chroma, row kernel", [](ViBe& vb){	vb.setInput(INPUT_NV12, true);	}, true, INPUT_NV12},
+		{"row bands of 16 rows", [](ViBe& vb){	vb.setKernel(KERNEL_ROW);	}, true, INPUT_PACKED, 16},
+		{"row bands, burst initialization", [](ViBe& vb){	vb.setInitFrames(5);	}, false, INPUT_PACKED, 16},
+		{"pipelined blob labelling", [](ViBe& vb){	vb.setKernel(KERNEL_ROW);	}, true, INPUT_PACKED, 0, true},
+	};
+
+	vector<Sequence> sequences;
+	sequences.push_back(syntheticSequence("synthetic gray", CV_8UC1, 60));
+	sequences.push_back(syntheticSequence("synthetic color", CV_8UC3, 60));
+	for(int i = 1; i < argc; i++){
+		Sequence seq;
+		if(recordedSequence(argv[i], 150, seq))
+			sequences.push_back(seq);
+		else
+			check(false, string("open ") + argv[i]);
+	}
+
+	for(const Sequence& seq : sequences){
+		Run ref = runVariant(seq, reference);
+		checkMaskStream(seq, ref);
+		checkShmRing(seq, ref);
+		if(!seq.truth.empty())
+			checkTracker(seq, ref);
+		checkSteadyAllocations(seq, false);
+		checkSteadyAllocations(seq, true);
+		checkPipelineGaps(seq, ref);
+		checkBitMask(seq, ref);
+		checkFillNeighbor(seq);
+		if(!seq.truth.empty() && seq.frames[0].channels() == 1)
+			checkChunks(seq, ref);
+		// the burst model is swapped in at a fixed frame, the same seed gives the same output
+		const Variant burst = {"burst initialization, same seed twice", [](ViBe& vb){	vb.setInitFrames(5);	}, true};
+		compareExact(seq, runVariant(seq, burst), runVariant(seq, burst), burst.name);
+		for(const Variant& v : variants){
+			if(v.input != INPUT_PACKED && seq.frames[0].channels() != 3)
+				continue;
+			if(v.exact && v.input != INPUT_PACKED){
+				const Variant planar_reference = {"reference", [&v](ViBe& vb){	v.setup(vb);	vb.setKernel(KERNEL_REFERENCE);	}, true, v.input};
+				compareExact(seq, runVariant(seq, planar_reference), runVariant(seq, v), v.name);
+			}else if(v.exact)
+				compareExact(seq, ref, runVariant(seq, v), v.name);
+			else if(!seq.truth.empty())
+				compareStatistical(seq, ref, runVariant(seq, v), v.name);
+		}
+	}
+
+	cout << (failures ? to_string(failures) + " check(s) failed" : "all checks passed") << endl;
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,153 @@
+#include "bitMask.h"
+
+#include <algorithm>
+
+using namespace std;
+using namespace cv;
+
+static inline int lowestBit(uint64_t w){
+#if defined(__GNUC__)
+	return __builtin_ctzll(w);
+#else
+	int n = 0;
+	while(!(w & 1)){
+		w >>= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+static inline int popCount(uint64_t w){
+#if defined(__GNUC__)
+	return __builtin_popcountll(w);
+#else
+	int n = 0;
+	for(; w; w &= w-1)
+		n++;
+	return n;
+#endif
+}
+
+// bits [from, to) of a word, 0 <= from < to <= 64
+static inline uint64_t bitRange(int from, int to){
+	uint64_t high = to == 64 ? ~uint64_t(0) : (uint64_t(1) << to) - 1;
+	return high & (~uint64_t(0) << from);
+}
+
+void BitMask::create(int w, int h){
+	width = w;
+	height = h;
+	words = (w + 63)/64;
+	bits.assign((size_t)words*h, 0);
+}
+
+void BitMask::toMat(Mat& m, uchar on)	const{
+	m.create(height, width, CV_8UC1);
+	for(int i = 0; i < height; i++){
+		const uint64_t* r = row(i);
+		uchar* dst = m.ptr<uchar>(i);
+		for(int k = 0; k < words; k++){
+			uint64_t w = r[k];
+			int end = std::min(64, width - k*64);
+			for(int b = 0; b < end; b++, w >>= 1)
+				dst[k*64 + b] = (w & 1) ? on : 0;
+		}
+	}
+}
+
+void BitMask::fromMat(const Mat& m){
+	create(m.cols, m.rows);
+	for(int i = 0; i < height; i++){
+		const uchar* src = m.ptr<uchar>(i);
+		uint64_t* r = row(i);
+		for(int j = 0; j < width; j++)
+			if(src[j])
+				r[j >> 6] |= uint64_t(1) << (j & 63);
+	}
+}
+
+int BitMask::count()	const{
+	int n = 0;
+	for(uint64_t w : bits)
+		n += popCount(w);
+	return n;
+}
+
+int BitMask::count(const Rect& roi)	const{
+	Rect r = roi & Rect(0, 0, width, height);
+	if(r.area() == 0)	return 0;
+	const int first = r.x >> 6, last = (r.x + r.width - 1) >> 6;
+	int n = 0;
+	for(int i = r.y; i < r.y + r.height; i++){
+		const uint64_t* words_i = row(i);
+		for(int k = first; k <= last; k++){
+			int from = k == first ? r.x & 63 : 0, to = k == last ? ((r.x + r.width - 1) & 63) + 1 : 64;
+			n += popCount(words_i[k] & bitRange(from, to));
+		}
+	}
+	return n;
+}
+
+void BitMask::intersect(const BitMask& other){
+	CV_Assert(other.width == width && other.height == height);
+	for(size_t k = 0; k < bits.size(); k++)
+		bits[k] &= other.bits[k];
+}
+
+int BitMask::nextPixel(int i, int from, bool value)	const{
+	int k = from >> 6;
+	if(k >= words)	return width;
+	const uint64_t* r = row(i);
+	// padding bits are 0, searching for 0 may stop in the padding, hence the min
+	uint64_t w = (value ? r[k] : ~r[k]) & (~uint64_t(0) << (from & 63));
+	while(!w){
+		if(++k >= words)	return width;
+		w = value ? r[k] : ~r[k];
+	}
+	return std::min(width, k*64 + lowestBit(w));
+}
+
+void BitMask::dilate(BitMask& dst)	const{
+	morphology<true>(dst);
+}
+
+void BitMask::erode(BitMask& dst)	const{
+	morphology<false>(dst);
+}
+
+// A horizontal pass combines every pixel with its left and right neighbors through word
+// shifts, the bit crossing a word boundary comes from the next or previous word. A vertical
+// pass then combines three rows of the horizontal pass. Pixels out of the image, padding
+// included, are 0 for the dilation and 1 for the erosion, so they never change the result.
+template<bool DILATE>
+void BitMask::morphology(BitMask& dst)	const{
+	const uint64_t outside = DILATE ? 0 : ~uint64_t(0), padding = ~lastWordMask();
+	scratch.resize(bits.size());
+	for(int i = 0; i < height; i++){
+		const uint64_t* r = row(i);
+		uint64_t* h = &scratch[(size_t)i*words];
+		for(int k = 0; k < words; k++){
+			uint64_t w = r[k], prev = k > 0 ? r[k-1] : outside, next = k+1 < words ? r[k+1] : outside;
+			if(!DILATE){
+				if(k == words-1)	w |= padding;
+				if(k+1 == words-1)	next |= padding;
+			}
+			uint64_t left = (w << 1) | (prev >> 63), right = (w >> 1) | (next << 63);
+			h[k] = DILATE ? (w | left | right) : (w & left & right);
+		}
+	}
+
+	dst.create(width, height);
+	for(int i = 0; i < height; i++){
+		const uint64_t* above = i > 0 ? &scratch[(size_t)(i-1)*words] : NULL;
+		const uint64_t* center = &scratch[(size_t)i*words];
+		const uint64_t* below = i+1 < height ? &scratch[(size_t)(i+1)*words] : NULL;
+		uint64_t* d = dst.row(i);
+		for(int k = 0; k < words; k++){
+			uint64_t a = above ? above[k] : outside, b = below ? below[k] : outside;
+			d[k] = DILATE ? (a | center[k] | b) : (a & center[k] & b);
+		}
+		d[words-1] &= lastWordMask();
+	}
+}
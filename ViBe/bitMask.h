@@ -0,0 +1,69 @@
+#include <opencv2/opencv.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#ifndef BIT_MASK_H
+#define BIT_MASK_H
+
+// Binary image with one bit per pixel, rows are padded to whole 64 bit words and the
+// padding bits are always 0. Pixel j of a row is bit j%64 of word j/64.
+// The whole-image operations work on words of 64 pixels.
+class BitMask{
+public:
+	BitMask():width(0), height(0), words(0){}
+
+	// all pixels are cleared, the storage is only reallocated when the size changes
+	void create(int width, int height);
+	bool empty()	const{	return bits.empty();	}
+	int getWidth()	const{	return width;	}
+	int getHeight()	const{	return height;	}
+	int getWordsPerRow()	const{	return words;	}
+
+	uint64_t* row(int i){	return &bits[(size_t)i*words];	}
+	const uint64_t* row(int i)	const{	return &bits[(size_t)i*words];	}
+	bool get(int i, int j)	const{	return (row(i)[j >> 6] >> (j & 63)) & 1;	}
+	void set(int i, int j, bool value){
+		uint64_t bit = uint64_t(1) << (j & 63);
+		if(value)	row(i)[j >> 6] |= bit;
+		else	row(i)[j >> 6] &= ~bit;
+	}
+	// mask of the valid bits of the last word of a row
+	uint64_t lastWordMask()	const{	return width & 63 ? (uint64_t(1) << (width & 63)) - 1 : ~uint64_t(0);	}
+
+	// CV_8UC1 with on for set pixels and 0 elsewhere, m is reused when it has the right size
+	void toMat(cv::Mat& m, uchar on = 255)	const;
+	// any non zero pixel of a CV_8UC1 is set
+	void fromMat(const cv::Mat& m);
+
+	// number of set pixels, in the whole image or inside roi
+	int count()	const;
+	int count(const cv::Rect& roi)	const;
+	// keep only the pixels also set in other, of the same size
+	void intersect(const BitMask& other);
+	// 3x3 square dilation and erosion into dst, pixels out of the image do not change the
+	// result, as with cv::dilate and cv::erode and their default border
+	void dilate(BitMask& dst)	const;
+	void erode(BitMask& dst)	const;
+
+	// first pixel at or after from in row i whose value is value, width if there is none
+	int nextPixel(int i, int from, bool value)	const;
+	// calls f(start, end) for every run [start, end) of set pixels of row i, left to right
+	template<typename F>
+	void forEachRun(int i, F f)	const{
+		for(int start = nextPixel(i, 0, true); start < width; start = nextPixel(i, start, true)){
+			int end = nextPixel(i, start, false);
+			f(start, end);
+			start = end;
+		}
+	}
+
+private:
+	int width, height, words;
+	std::vector<uint64_t> bits;
+	mutable std::vector<uint64_t> scratch;	// horizontal pass of the morphology
+
+	template<bool DILATE> void morphology(BitMask& dst)	const;
+};
+
+#endif
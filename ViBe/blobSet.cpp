@@ -0,0 +1,140 @@
+#include "blobSet.h"
+
+#include <algorithm>
+#include <numeric>
+
+using namespace std;
+using namespace cv;
+
+BlobSet::BlobSet():
+	width(0),
+	height(0),
+	has_rot_bboxes(false),
+	has_pixels(false),
+	has_contours(false),
+	has_mask(false)
+{}
+
+void BlobSet::reset(int w, int h){
+	width = w;
+	height = h;
+	bboxes.clear();
+	runs.clear();
+	run_ranges.clear();
+	has_rot_bboxes = has_pixels = has_contours = has_mask = false;
+}
+
+void BlobSet::add(const Rect& box, const BlobRun* blob_runs, int count){
+	has_rot_bboxes = has_pixels = has_contours = has_mask = false;
+	pool.push_back(bboxes, box);
+	pool.push_back(run_ranges, Vec2i((int)runs.size(), count));
+	pool.reserve(runs, runs.size() + count);
+	runs.insert(runs.end(), blob_runs, blob_runs + count);
+}
+
+void BlobSet::finish(){
+	// sort boxes and run ranges together so that every field keeps the same blob order,
+	// equal areas are in the raster order of their first pixel
+	pool.reserve(order, bboxes.size());
+	order.resize(bboxes.size());
+	iota(order.begin(), order.end(), 0);
+	sort(order.begin(), order.end(), [this](int a, int b){
+			if(bboxes[a].area() != bboxes[b].area())
+				return bboxes[a].area() > bboxes[b].area();
+			const BlobRun& first_a = runs[run_ranges[a][0]], &first_b = runs[run_ranges[b][0]];
+			return first_a.row < first_b.row || (first_a.row == first_b.row && first_a.start < first_b.start);	});
+
+	pool.reserve(sorted_boxes, bboxes.size());
+	pool.reserve(sorted_ranges, run_ranges.size());
+	sorted_boxes.clear();
+	sorted_ranges.clear();
+	for(unsigned int i = 0; i < order.size(); i++){
+		sorted_boxes.push_back(bboxes[order[i]]);
+		sorted_ranges.push_back(run_ranges[order[i]]);
+	}
+	// swapping keeps both capacities for the next frame
+	bboxes.swap(sorted_boxes);
+	run_ranges.swap(sorted_ranges);
+}
+
+const vector<vector<Point2i> >& BlobSet::getPixels()	const{
+	if(has_pixels)	return pixels;
+
+	pool.resize(pixels, spare_pixels, bboxes.size());
+	for(unsigned int b = 0; b < bboxes.size(); b++){
+		pixels[b].clear();
+		for(int k = run_ranges[b][0]; k < run_ranges[b][0] + run_ranges[b][1]; k++)
+			for(int j = runs[k].start; j < runs[k].end; j++)
+				pool.push_back(pixels[b], Point2i(j, runs[k].row));
+	}
+	has_pixels = true;
+	return pixels;
+}
+
+const vector<vector<Point> >& BlobSet::getContours()	const{
+	if(has_contours)	return contours;
+
+	pool.resize(contours, spare_contours, bboxes.size());
+	// pixel (x, y) is at (x+1, y+1) of the buffer, every blob image keeps a 1 pixel background
+	// margin: findContours of OpenCV before 3.2 ignores the outermost pixels of its image
+	pool.create(blob_buffer, height + 2, width + 2, CV_8UC1);
+	for(unsigned int b = 0; b < bboxes.size(); b++){
+		const Rect& r = bboxes[b];
+		// binary image of this blob only, inside its bounding box and the margin
+		Mat blob_mask = blob_buffer(Rect(r.x, r.y, r.width + 2, r.height + 2));
+		blob_mask.setTo(0);
+		for(int k = run_ranges[b][0]; k < run_ranges[b][0] + run_ranges[b][1]; k++){
+			uchar* row = blob_buffer.ptr<uchar>(runs[k].row + 1) + 1;
+			std::fill(row + runs[k].start, row + runs[k].end, 255);
+		}
+		findContours(blob_mask, blob_contours, RETR_EXTERNAL, CHAIN_APPROX_NONE, r.tl() - Point(1, 1));
+		// a 4-connected blob has one external contour, concatenate in case of corner touching
+		contours[b].clear();
+		for(const auto& c : blob_contours){
+			pool.reserve(contours[b], contours[b].size() + c.size());
+			contours[b].insert(contours[b].end(), c.begin(), c.end());
+		}
+	}
+	has_contours = true;
+	return contours;
+}
+
+const vector<RotatedRect>& BlobSet::getRotBboxes()	const{
+	if(has_rot_bboxes)	return rot_bboxes;
+
+	// the end pixels of the runs have the same convex hull as the pixel list, with no
+	// rasterization and at most two points per row
+	pool.reserve(rot_bboxes, bboxes.size());
+	rot_bboxes.resize(bboxes.size());
+	for(unsigned int b = 0; b < bboxes.size(); b++){
+		hull_points.clear();
+		for(int k = run_ranges[b][0]; k < run_ranges[b][0] + run_ranges[b][1]; k++){
+			pool.push_back(hull_points, Point(runs[k].start, runs[k].row));
+			if(runs[k].end - 1 > runs[k].start)
+				pool.push_back(hull_points, Point(runs[k].end - 1, runs[k].row));
+		}
+		rot_bboxes[b] = minAreaRect(hull_points);
+	}
+	has_rot_bboxes = true;
+	return rot_bboxes;
+}
+
+const Mat& BlobSet::getMask()	const{
+	if(has_mask)	return mask;
+
+	const vector<RotatedRect>& rots = getRotBboxes();
+	pool.create(mask, height, width, CV_8UC1);
+	mask.setTo(0);
+	for(unsigned int b = 0; b < rots.size(); b++){
+		Point2f vertices[4];
+		Point v[4];
+		rots[b].points(vertices);
+
+		for(int s = 0; s < 4; s++)
+			v[s] = Point(int(vertices[s].x), int(vertices[s].y));
+
+		fillConvexPoly(mask, v, 4, 255);
+	}
+	has_mask = true;
+	return mask;
+}
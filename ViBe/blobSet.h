@@ -0,0 +1,71 @@
+#include <opencv2/opencv.hpp>
+
+#include <vector>
+
+#include "bufferPool.h"
+
+#ifndef BLOB_SET_H
+#define BLOB_SET_H
+
+// pixels [start, end) of one row of a blob
+struct BlobRun{
+	BlobRun(int r = 0, int s = 0, int e = 0):row(r), start(s), end(e){}
+	int row, start, end;
+};
+
+// Blobs found in one foreground frame, each one is given as its runs in raster order.
+// Only the axis-aligned boxes are computed while labelling; pixel lists, contours,
+// rotated rectangles and the rasterized mask are computed on first access and
+// cached until the next frame is labelled.
+class BlobSet{
+public:
+	BlobSet();
+
+	// start a new frame of width x height
+	void reset(int width, int height);
+	// add a blob with its bounding box and its count runs, they are copied
+	void add(const cv::Rect& box, const BlobRun* runs, int count);
+	// sort blobs from the largest to the smallest bounding box
+	void finish();
+
+	int size()	const{	return bboxes.size();	}
+	bool empty()	const{	return bboxes.empty();	}
+
+	const std::vector<cv::Rect>& getBBoxes()	const{	return bboxes;	}
+	const std::vector<cv::RotatedRect>& getRotBboxes()	const;
+	// every foreground pixel of each blob
+	const std::vector<std::vector<cv::Point2i> >& getPixels()	const;
+	// external contours of each blob
+	const std::vector<std::vector<cv::Point> >& getContours()	const;
+	// rotated bounding boxes rasterized into a CV_8UC1 mask
+	const cv::Mat& getMask()	const;
+
+	// buffers are reused from frame to frame, see BufferPool
+	unsigned long getAllocationCount()	const{	return pool.getAllocationCount();	}
+
+private:
+	int width, height;
+	std::vector<cv::Rect> bboxes;
+	std::vector<BlobRun> runs;	// runs of all the blobs
+	std::vector<cv::Vec2i> run_ranges;	// first run and run count of each blob
+
+	// lazily computed fields
+	mutable bool has_rot_bboxes, has_pixels, has_contours, has_mask;
+	mutable std::vector<cv::RotatedRect> rot_bboxes;
+	mutable std::vector<std::vector<cv::Point2i> > pixels;
+	mutable std::vector<std::vector<cv::Point> > contours;
+	mutable cv::Mat mask;
+
+	// reused buffers
+	mutable BufferPool pool;
+	std::vector<int> order;
+	std::vector<cv::Rect> sorted_boxes;
+	std::vector<cv::Vec2i> sorted_ranges;
+	mutable std::vector<std::vector<cv::Point2i> > spare_pixels;
+	mutable std::vector<std::vector<cv::Point> > spare_contours;
+	mutable std::vector<std::vector<cv::Point> > blob_contours;
+	mutable cv::Mat blob_buffer;	// binary image of one blob at a time, frame sized with a 1 pixel margin
+	mutable std::vector<cv::Point> hull_points;	// run end pixels of one blob
+};
+
+#endif
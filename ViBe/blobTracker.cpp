@@ -0,0 +1,151 @@
+#include "blobTracker.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+using namespace cv;
+
+BlobTracker::BlobTracker(float iou, float dist, int missed, int cell):
+	min_iou(iou),
+	max_dist(dist),
+	max_missed(missed),
+	cell_size(std::max(8, cell)),
+	next_id(0),
+	grid_cols(0),
+	grid_rows(0)
+{}
+
+// cells covered by r grown by max_dist, clamped to the grid
+Rect BlobTracker::cellRange(const Rect& r)	const{
+	int margin = cvCeil(max_dist);
+	int x0 = std::max(0, (r.x - margin)/cell_size), y0 = std::max(0, (r.y - margin)/cell_size);
+	int x1 = std::min(grid_cols-1, (r.x + r.width + margin)/cell_size);
+	int y1 = std::min(grid_rows-1, (r.y + r.height + margin)/cell_size);
+	return Rect(x0, y0, x1-x0+1, y1-y0+1);
+}
+
+void BlobTracker::buildGrid(){
+	track_ptrs.clear();
+	predicted.clear();
+	int max_x = 0, max_y = 0;
+	for(auto& t : active){
+		track_ptrs.push_back(&t.second);
+		predicted.push_back(t.second.predict());
+		max_x = std::max(max_x, predicted.back().br().x);
+		max_y = std::max(max_y, predicted.back().br().y);
+	}
+
+	grid_cols = max_x/cell_size + 1;
+	grid_rows = max_y/cell_size + 1;
+	if((int)grid.size() < grid_cols*grid_rows)
+		grid.resize(grid_cols*grid_rows);
+	for(auto& cell : grid)
+		cell.clear();
+
+	// every track goes in the cells its predicted box covers
+	for(unsigned int t = 0; t < track_ptrs.size(); t++){
+		const Rect& r = predicted[t];
+		int x0 = std::max(0, r.x/cell_size), y0 = std::max(0, r.y/cell_size);
+		int x1 = std::max(0, (r.x + r.width)/cell_size), y1 = std::max(0, (r.y + r.height)/cell_size);
+		for(int y = y0; y <= y1; y++)
+			for(int x = x0; x <= x1; x++)
+				grid[y*grid_cols + x].push_back(t);
+	}
+}
+
+const vector<int>& BlobTracker::update(int frame_id, const vector<Rect>& boxes){
+	buildGrid();
+
+	// candidate pairs from the cells around each box
+	candidates.clear();
+	visited.assign(track_ptrs.size(), -1);
+	for(unsigned int b = 0; b < boxes.size(); b++){
+		const Rect& box = boxes[b];
+		Point2f c(box.x + box.width*0.5f, box.y + box.height*0.5f);
+		Rect range = cellRange(box);
+		for(int y = range.y; y < range.y + range.height; y++)
+			for(int x = range.x; x < range.x + range.width; x++)
+				for(int t : grid[y*grid_cols + x]){
+					if(visited[t] == (int)b)	continue;
+					visited[t] = b;
+
+					const Rect& p = predicted[t];
+					double inter = (box & p).area();
+					float iou = inter > 0 ? inter/(box.area() + p.area() - inter) : 0;
+					Point2f d = c - Point2f(p.x + p.width*0.5f, p.y + p.height*0.5f);
+					float dist = sqrt(d.x*d.x + d.y*d.y);
+					if(iou < min_iou && dist > max_dist)	continue;
+
+					Candidate cand;
+					cand.score = iou + 0.1f*(1 - std::min(dist, max_dist)/max_dist);
+					cand.box = b;
+					cand.track = t;
+					candidates.push_back(cand);
+				}
+	}
+	sort(candidates.begin(), candidates.end());
+
+	// greedy assignment, best pairs first
+	ids.assign(boxes.size(), -1);
+	track_matched.assign(track_ptrs.size(), 0);
+	for(const Candidate& cand : candidates){
+		if(ids[cand.box] >= 0 || track_matched[cand.track])	continue;
+		Track& track = *track_ptrs[cand.track];
+		const Rect& box = boxes[cand.box];
+		Point2f moved = Point2f(box.x + box.width*0.5f, box.y + box.height*0.5f)
+			- Point2f(track.box.x + track.box.width*0.5f, track.box.y + track.box.height*0.5f);
+		track.velocity = moved*(1.0f/(track.missed + 1));
+		track.box = box;
+		track.missed = 0;
+		track.trajectory.push_back(TrajUnit(frame_id, box));
+		ids[cand.box] = track.id;
+		track_matched[cand.track] = 1;
+	}
+
+	// unmatched tracks age and end after max_missed frames
+	for(unsigned int t = 0; t < track_ptrs.size(); t++){
+		if(track_matched[t])	continue;
+		Track* track = track_ptrs[t];
+		if(++track->missed > max_missed){
+			ended[track->id].swap(track->trajectory);
+			active.erase(track->id);
+		}
+	}
+
+	// unmatched boxes start new tracks
+	for(unsigned int b = 0; b < boxes.size(); b++){
+		if(ids[b] >= 0)	continue;
+		Track& track = active[next_id];
+		track.id = next_id++;
+		track.box = boxes[b];
+		track.trajectory.push_back(TrajUnit(frame_id, boxes[b]));
+		ids[b] = track.id;
+	}
+	return ids;
+}
+
+void BlobTracker::getTrajectories(map<int, TrajVec>& trajectories)	const{
+	trajectories = ended;
+	for(const auto& t : active)
+		trajectories[t.first] = t.second.trajectory;
+}
+
+bool BlobTracker::writeTrajectories(const string& file_name)	const{
+	ofstream outfile(file_name.c_str());
+	if(!outfile.is_open()){
+		cerr << "Failed to open file " << file_name << endl;
+		return false;
+	}
+
+	map<int, TrajVec> trajectories;
+	getTrajectories(trajectories);
+	// written in object id order, as readGroundTruthFromFile expects
+	for(const auto& traj : trajectories)
+		for(const TrajUnit& u : traj.second)
+			outfile << traj.first << " " << u.box.x << " " << u.box.y << " " << u.box.width << " "
+				<< u.box.height << " " << u.frame_id << " " << u.if_occluded << "\n";
+	cout << "write " << trajectories.size() << " trajectories to " << file_name << endl;
+	return true;
+}
@@ -0,0 +1,72 @@
+#include <opencv2/opencv.hpp>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "trajDebugger.h"
+
+#ifndef BLOB_TRACKER_H
+#define BLOB_TRACKER_H
+
+struct Track{
+	Track(int i = -1):id(i), missed(0), velocity(0, 0){}
+	int id;
+	int missed;				// frames since the last matched blob
+	cv::Rect box;			// last matched box
+	cv::Point2f velocity;	// center displacement per frame
+	TrajVec trajectory;
+
+	// box expected in the next frame
+	cv::Rect predict()	const{	return box + cv::Point(cvRound(velocity.x), cvRound(velocity.y));	}
+};
+
+// Links the blobs of consecutive frames into tracks.
+// A blob and a track match when the IoU with the predicted box reaches min_iou or their
+// centers are closer than max_dist, the best pairs are taken first. The predicted boxes are
+// indexed in a uniform grid so that every blob is only compared with the tracks around it.
+class BlobTracker{
+public:
+	BlobTracker(float min_iou = 0.2, float max_dist = 40, int max_missed = 5, int cell_size = 64);
+
+	// associate the boxes of a frame, return the track id of every box
+	const std::vector<int>& update(int frame_id, const std::vector<cv::Rect>& boxes);
+
+	const std::map<int, Track>& getActiveTracks()	const{	return active;	}
+	// every track with its trajectory, ended or not
+	void getTrajectories(std::map<int, TrajVec>& trajectories)	const;
+	// one line per box, obj_id x y width height frame_id occluded, as TrajDebugger::readTrajLine reads
+	bool writeTrajectories(const std::string& file_name)	const;
+
+private:
+	float min_iou;
+	float max_dist;
+	int max_missed;
+	int cell_size;
+	int next_id;
+
+	std::map<int, Track> active;
+	std::map<int, TrajVec> ended;
+
+	// grid of predicted track boxes, rebuilt every frame
+	int grid_cols, grid_rows;
+	std::vector<std::vector<int> > grid;	// indices in track_ptrs
+	std::vector<Track*> track_ptrs;
+	std::vector<int> visited;	// last box that looked at each track, avoids duplicates across cells
+	std::vector<cv::Rect> predicted;
+
+	struct Candidate{
+		float score;
+		int box;
+		int track;
+		bool operator<(const Candidate& c)	const{	return score > c.score || (score == c.score && (box < c.box || (box == c.box && track < c.track)));	}
+	};
+	std::vector<Candidate> candidates;
+	std::vector<int> ids;
+	std::vector<char> track_matched;
+
+	void buildGrid();
+	cv::Rect cellRange(const cv::Rect& r)	const;
+};
+
+#endif
@@ -0,0 +1,63 @@
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <vector>
+
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+// Keeps the working buffers of an instance alive between frames. Buffers only grow, so once
+// the sizes of a stream are reached nothing is allocated any more. Every (re)allocation of a
+// pooled buffer is counted, a count that stays the same from frame to frame means that no
+// pooled buffer was allocated; allocations made elsewhere, e.g. inside OpenCV, are not seen.
+class BufferPool{
+public:
+	BufferPool():allocations(0){}
+
+	unsigned long getAllocationCount()	const{	return allocations;	}
+
+	// (re)allocate m only when its size or type changes
+	void create(cv::Mat& m, int rows, int cols, int type){
+		if(m.empty() || m.rows != rows || m.cols != cols || m.type() != type){
+			m.create(rows, cols, type);
+			allocations++;
+		}
+	}
+
+	template<typename T>
+	void reserve(std::vector<T>& v, size_t n){
+		if(v.capacity() < n){
+			v.reserve(std::max(n, 2*v.capacity()));
+			allocations++;
+		}
+	}
+
+	template<typename T>
+	void push_back(std::vector<T>& v, const T& value){
+		reserve(v, v.size()+1);
+		v.push_back(value);
+	}
+
+	// resize a vector of vectors, the inner vectors dropped by a shrink are kept in spare
+	// with their capacity and given back on the next growth
+	template<typename T>
+	void resize(std::vector<std::vector<T> >& v, std::vector<std::vector<T> >& spare, size_t n){
+		while(v.size() > n){
+			push_back(spare, std::vector<T>());
+			spare.back().swap(v.back());
+			v.pop_back();
+		}
+		reserve(v, n);
+		while(v.size() < n){
+			v.push_back(std::vector<T>());
+			if(spare.empty())	continue;
+			v.back().swap(spare.back());
+			spare.pop_back();
+		}
+	}
+
+private:
+	unsigned long allocations;
+};
+
+#endif
@@ -0,0 +1,176 @@
+#include <iostream>
+#include <cstdio>
+#include <thread>
+
+#include "chunkProcessor.h"
+#include "frameSource.h"
+#include "maskStream.h"
+
+using namespace std;
+using namespace cv;
+
+ChunkProcessor::ChunkProcessor(int chunks, int warm_up, bool backward):
+	chunks(std::max(1, chunks)), warm_up(std::max(0, warm_up)), backward(backward), decimation(1), planar(false), use_chroma(false),
+	total_frames(0), wall_seconds(0), stitch_seconds(0){
+}
+
+bool ChunkProcessor::run(const string& video_name, const string& out_mask_name, int frame_count, int raw_width, int raw_height){
+	FrameSource src;
+	if(!src.open(video_name, raw_width, raw_height)){
+		cerr << "Failed to open the video " << video_name << endl;
+		return false;
+	}
+	total_frames = src.get(CAP_PROP_FRAME_COUNT);
+	src.release();
+	if(frame_count >= 0)
+		total_frames = std::min(total_frames, frame_count);
+	if(total_frames <= 0){
+		cerr << "the frame count of " << video_name << " is unknown, it cannot be split in chunks" << endl;
+		return false;
+	}
+
+	int64 begin = getTickCount();
+	int n = std::min(chunks, total_frames);
+	stats.assign(n, ChunkStats());
+	vector<string> part_names(n);
+	for(int c = 0; c < n; c++){
+		stats[c].first_frame = (long)c*total_frames/n;
+		stats[c].end_frame = (long)(c+1)*total_frames/n;
+		part_names[c] = out_mask_name + ".part" + to_string(c);
+	}
+
+	vector<char> ok(n, 0);
+	vector<thread> threads;
+	for(int c = 0; c < n; c++)
+		threads.push_back(thread([&, c](){
+			ok[c] = runChunk(c, video_name, part_names[c], raw_width, raw_height);
+		}));
+	for(thread& t : threads)
+		t.join();
+
+	bool all_ok = true;
+	for(int c = 0; c < n; c++)
+		if(!ok[c]){
+			cerr << "chunk " << c << " failed" << endl;
+			all_ok = false;
+		}
+
+	int64 stitch_begin = getTickCount();
+	all_ok = all_ok && stitch(out_mask_name, part_names);
+	for(const string& part : part_names){
+		remove(part.c_str());
+		remove((part + ".jsonl").c_str());
+	}
+	stitch_seconds = (getTickCount() - stitch_begin)/getTickFrequency();
+	wall_seconds = (getTickCount() - begin)/getTickFrequency();
+	return all_ok;
+}
+
+// Frames are processed at the positions a sequential run with the same decimation would
+// process, frame f is given to ViBe only if f is a multiple of decimation.
+bool ChunkProcessor::runChunk(int c, const string& video_name, const string& part_name, int raw_width, int raw_height){
+	ChunkStats& s = stats[c];
+	int64 begin = getTickCount();
+	FrameSource src;
+	if(!src.open(video_name, raw_width, raw_height))
+		return false;
+	src.setPlanar(planar);
+
+	ViBe vb;
+	vb.setDecimation(decimation);
+	if(planar)
+		vb.setInput(src.getPlanarFormat() == RAW_NV12 ? INPUT_NV12 : INPUT_I420, use_chroma);
+	if(setup)	setup(vb);
+
+	// warm up the model without computing blobs, the foreground is never converted to bytes
+	Mat frame;
+	if(backward){
+		// from the last warm-up frame back to the first output frame
+		int last = std::min(s.first_frame + warm_up, total_frames) - 1;
+		last -= last % decimation;
+		for(int f = last; f >= s.first_frame; f -= decimation){
+			src.set(CAP_PROP_POS_FRAMES, f);
+			src >> frame;
+			if(frame.empty() || !vb.process(frame, "", false))
+				return false;
+			s.warm_up_frames++;
+		}
+		src.set(CAP_PROP_POS_FRAMES, s.first_frame);
+	}else{
+		int from = std::max(0, s.first_frame - warm_up);
+		from -= from % decimation;
+		src.set(CAP_PROP_POS_FRAMES, from);
+		for(int f = from; f < s.first_frame; f++){
+			if(f % decimation){
+				src.grab();
+				continue;
+			}
+			src >> frame;
+			if(frame.empty() || !vb.process(frame, "", false))
+				return false;
+			s.warm_up_frames++;
+		}
+	}
+
+	MaskWriter writer;
+	for(int f = s.first_frame; f < s.end_frame; f++){
+		if(f % decimation){
+			src.grab();
+			continue;
+		}
+		src >> frame;
+		if(frame.empty() || !vb.process(frame))
+			return false;
+		const BitMask& fore = vb.getForegroundBits();
+		if(!writer.isOpened() && !writer.open(part_name, fore.getWidth(), fore.getHeight()))
+			return false;
+		writer.write(f+1, fore, vb.getBBoxes(), vb.getRotBboxes());
+		s.output_frames++;
+	}
+	writer.close();
+	src.release();
+	s.seconds = (getTickCount() - begin)/getTickFrequency();
+	return true;
+}
+
+// copy the records of the chunk files one after another into the output, they are already in
+// frame order: the encoded masks and the blob lines are copied as they are, only the index
+// is written anew
+bool ChunkProcessor::stitch(const string& out_mask_name, const vector<string>& part_names){
+	MaskWriter writer;
+	MaskReader reader;
+	vector<uint8_t> runs;
+	string meta_line;
+	for(unsigned int c = 0; c < part_names.size(); c++){
+		if(stats[c].output_frames == 0)	continue;
+		if(!reader.open(part_names[c]))
+			return false;
+		if(!writer.isOpened() && !writer.open(out_mask_name, reader.getWidth(), reader.getHeight()))
+			return false;
+		for(int i = 0; i < reader.getFrameCount(); i++){
+			if(!reader.readEncoded(i, runs, meta_line) || !writer.writeEncoded(reader.getFrameId(i), runs, meta_line))
+				return false;
+		}
+		reader.close();
+	}
+	writer.close();
+	return true;
+}
+
+void ChunkProcessor::report(ostream& out)	const{
+	int output = 0, warm = 0;
+	double busy = 0;
+	out << "chunk\tframes\t\toutput\twarm-up\tseconds" << endl;
+	for(unsigned int c = 0; c < stats.size(); c++){
+		const ChunkStats& s = stats[c];
+		out << c << "\t" << s.first_frame << "-" << s.end_frame-1 << "\t" << s.output_frames << "\t"
+			<< s.warm_up_frames << "\t" << s.seconds << endl;
+		output += s.output_frames;
+		warm += s.warm_up_frames;
+		busy += s.seconds;
+	}
+	out << "output frames " << output << ", warm-up frames " << warm
+		<< " (overlap overhead " << (output > 0 ? 100.0*warm/output : 0) << "%)" << endl;
+	out << "wall time " << wall_seconds << " s, stitching " << stitch_seconds << " s, "
+		<< "chunks busy " << busy << " s (speed up " << (wall_seconds > 0 ? busy/wall_seconds : 0) << "x)" << endl;
+}
@@ -0,0 +1,74 @@
+#include <opencv2/opencv.hpp>
+
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "ViBe.h"
+
+#ifndef CHUNK_PROCESSOR_H
+#define CHUNK_PROCESSOR_H
+
+/*
+ * Offline processing of a long video on several cores.
+ *
+ * The frames are split into K consecutive chunks processed concurrently, each by its own
+ * reader and its own ViBe. Before its first output frame, a chunk warms its model up on
+ * the warm_up frames before the chunk, or with backward set on its own first warm_up
+ * frames taken backwards, the same way as the -b option of ViBe_main. The first chunk
+ * has no preceding frames: it starts cold, like a sequential run, unless backward is set.
+ *
+ * Every chunk writes a temporary mask file next to the output, the chunks are then
+ * stitched into one mask/blob stream in frame order and the temporary files removed.
+ * Frame ids are those of ViBe_main: 1 for the first frame of the video.
+ */
+
+struct ChunkStats{
+	ChunkStats():first_frame(0), end_frame(0), output_frames(0), warm_up_frames(0), seconds(0){}
+	int first_frame;	// first output frame, 0 based
+	int end_frame;		// one past the last output frame
+	int output_frames;	// frames written, less than the chunk length with decimation
+	int warm_up_frames;	// frames processed before the first output frame
+	double seconds;
+};
+
+class ChunkProcessor{
+public:
+	ChunkProcessor(int chunks, int warm_up = 100, bool backward = false);
+
+	// called on the ViBe of every chunk before its first frame
+	void setSetup(const std::function<void(ViBe&)>& s){	setup = s;	}
+	// only one of k frames is processed, the others are grabbed without being retrieved (default 1)
+	void setDecimation(int k){	decimation = std::max(1, k);	}
+	// classify planar YUV frames, see ViBe::setInput
+	void setPlanar(bool chroma){	planar = true;	use_chroma = chroma;	}
+
+	// process the first frame_count frames of video_name (all of them if frame_count < 0)
+	// and write their masks and blobs to out_mask_name
+	bool run(const std::string& video_name, const std::string& out_mask_name, int frame_count = -1,
+			int raw_width = 0, int raw_height = 0);
+
+	const std::vector<ChunkStats>& getStats()	const{	return stats;	}
+	double getWallSeconds()	const{	return wall_seconds;	}
+	double getStitchSeconds()	const{	return stitch_seconds;	}
+	// warm-up length per chunk, overlap overhead and speed up over the chunks run one after another
+	void report(std::ostream& out)	const;
+
+private:
+	int chunks;
+	int warm_up;
+	bool backward;
+	int decimation;
+	bool planar, use_chroma;
+	std::function<void(ViBe&)> setup;
+	int total_frames;
+	std::vector<ChunkStats> stats;
+	double wall_seconds;
+	double stitch_seconds;
+
+	bool runChunk(int c, const std::string& video_name, const std::string& part_name, int raw_width, int raw_height);
+	bool stitch(const std::string& out_mask_name, const std::vector<std::string>& part_names);
+};
+
+#endif
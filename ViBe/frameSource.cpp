@@ -0,0 +1,63 @@
+#include "frameSource.h"
+
+using namespace std;
+using namespace cv;
+
+bool FrameSource::open(const string& video_name, int raw_width, int raw_height){
+	use_raw = RawVideoReader::isRawFile(video_name);
+	if(use_raw)
+		return raw.open(video_name, raw_width, raw_height, RawVideoReader::formatFromName(video_name));
+	return cap.open(video_name);
+}
+
+double FrameSource::get(int prop){
+	if(!use_raw)	return cap.get(prop);
+	if(prop == CAP_PROP_FRAME_WIDTH)	return raw.getWidth();
+	if(prop == CAP_PROP_FRAME_HEIGHT)	return raw.getHeight();
+	if(prop == CAP_PROP_FRAME_COUNT)	return raw.getFrameCount();
+	if(prop == CAP_PROP_FPS)	return raw.getFPS();
+	if(prop == CAP_PROP_POS_FRAMES)	return raw.getPosition();
+	return 0;
+}
+
+bool FrameSource::set(int prop, double value){
+	if(!use_raw)	return cap.set(prop, value);
+	if(prop != CAP_PROP_POS_FRAMES)	return false;
+	raw.setPosition(value);
+	return true;
+}
+
+bool FrameSource::grab(){
+	return use_raw ? raw.grab() : cap.grab();
+}
+
+FrameSource& FrameSource::operator>>(Mat& frame){
+	if(planar){
+		if(use_raw && (raw.getFormat() == RAW_I420 || raw.getFormat() == RAW_NV12)){
+			raw.read(frame, VIEW_PLANAR);
+			return *this;
+		}
+		if(use_raw)
+			raw.read(decoded, VIEW_COLOR);
+		else
+			cap >> decoded;
+		if(decoded.empty())
+			frame.release();
+		else{
+			cvtColor(decoded, converted, COLOR_BGR2YUV_I420);
+			frame = converted;
+		}
+		return *this;
+	}
+	// packed BGR files keep their colour, the other raw files give their luma plane
+	if(use_raw)
+		raw.read(frame, raw.getFormat() == RAW_BGR ? VIEW_COLOR : VIEW_LUMA);
+	else
+		cap >> frame;
+	return *this;
+}
+
+void FrameSource::release(){
+	if(use_raw)	raw.close();
+	else	cap.release();
+}
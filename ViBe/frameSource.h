@@ -0,0 +1,36 @@
+#include <opencv2/opencv.hpp>
+
+#include <string>
+
+#include "rawReader.h"
+
+#ifndef FRAME_SOURCE_H
+#define FRAME_SOURCE_H
+
+// Frames come from VideoCapture, or for raw files straight from the mapped file,
+// with the part of the VideoCapture interface used by the programs.
+class FrameSource{
+public:
+	FrameSource():use_raw(false), planar(false){}
+
+	// raw_width/raw_height are the frame size of raw files, 0 to take it from the name
+	bool open(const std::string& video_name, int raw_width = 0, int raw_height = 0);
+	double get(int prop);
+	bool set(int prop, double value);
+	bool grab();
+	FrameSource& operator>>(cv::Mat& frame);
+	void release();
+	// hand out planar 4:2:0 frames, as mapped for .y4m/.yuv files, converted from BGR otherwise
+	void setPlanar(bool p){	planar = p;	}
+	// RAW_I420 or RAW_NV12, the layout of the planar frames
+	int getPlanarFormat()	const{	return use_raw && raw.getFormat() == RAW_NV12 ? RAW_NV12 : RAW_I420;	}
+
+private:
+	bool use_raw;
+	bool planar;
+	cv::Mat decoded, converted;
+	cv::VideoCapture cap;
+	RawVideoReader raw;
+};
+
+#endif
@@ -0,0 +1,405 @@
+#include "maskStream.h"
+#include "ViBe.h"
+
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <iomanip>
+#include <limits>
+
+using namespace std;
+using namespace cv;
+
+static const char MASK_MAGIC[8] = {'V','I','B','E','M','A','S','K'};
+static const char INDEX_MAGIC[8] = {'V','I','B','E','I','D','X','1'};
+static const uint32_t MASK_VERSION = 1;
+static const int HEADER_SIZE = 8 + 4 + 4 + 4;
+static const int FOOTER_SIZE = 8 + 4 + 8;
+static const uint64_t NO_META = ~uint64_t(0);
+
+template<typename T>
+static void writeValue(ostream& out, const T& value){
+	out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<typename T>
+static bool readValue(istream& in, T& value){
+	return bool(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+static void putVarint(vector<uint8_t>& buffer, uint32_t value){
+	while(value >= 0x80){
+		buffer.push_back(uint8_t(value | 0x80));
+		value >>= 7;
+	}
+	buffer.push_back(uint8_t(value));
+}
+
+static bool getVarint(const uint8_t*& p, const uint8_t* end, uint32_t& value){
+	value = 0;
+	for(int shift = 0; p < end && shift < 35; shift += 7){
+		uint8_t b = *p++;
+		value |= uint32_t(b & 0x7f) << shift;
+		if(!(b & 0x80))	return true;
+	}
+	return false;
+}
+
+MaskWriter::MaskWriter():width(0), height(0){}
+
+MaskWriter::~MaskWriter(){
+	close();
+}
+
+bool MaskWriter::open(const string& file_name, int w, int h){
+	close();
+	width = w;
+	height = h;
+	index.clear();
+
+	mask_file.open(file_name.c_str(), ios::binary | ios::trunc);
+	meta_file.open((file_name + ".jsonl").c_str(), ios::binary | ios::trunc);
+	if(!mask_file.is_open() || !meta_file.is_open()){
+		cerr << "Failed to open file " << file_name << endl;
+		mask_file.close();
+		meta_file.close();
+		return false;
+	}
+
+	mask_file.write(MASK_MAGIC, sizeof(MASK_MAGIC));
+	writeValue(mask_file, MASK_VERSION);
+	writeValue(mask_file, int32_t(width));
+	writeValue(mask_file, int32_t(height));
+	return bool(mask_file);
+}
+
+void MaskWriter::encodeRuns(const Mat& fore, vector<uint8_t>& buffer){
+	buffer.clear();
+	// runs continue across rows, the first run is background and may be empty
+	bool in_fore = false;
+	uint32_t run = 0;
+	for(int i = 0; i < fore.rows; i++){
+		const uchar* row = fore.ptr<uchar>(i);
+		for(int j = 0; j < fore.cols; j++){
+			if((row[j] != 0) != in_fore){
+				putVarint(buffer, run);
+				in_fore = !in_fore;
+				run = 0;
+			}
+			run++;
+		}
+	}
+	putVarint(buffer, run);
+}
+
+// the same runs from the words of the mask, a foreground run that reaches the end of a
+// row is only written once it is known whether the next row continues it
+void MaskWriter::encodeRuns(const BitMask& fore, vector<uint8_t>& buffer){
+	buffer.clear();
+	const uint64_t total = (uint64_t)fore.getWidth()*fore.getHeight();
+	uint64_t written = 0, start = 0, end = 0;
+	bool pending = false;
+	for(int i = 0; i < fore.getHeight(); i++){
+		const uint64_t row_start = (uint64_t)i*fore.getWidth();
+		fore.forEachRun(i, [&](int s, int e){
+			if(pending && row_start + s == end){
+				end = row_start + e;
+				return;
+			}
+			if(pending){
+				putVarint(buffer, start - written);
+				putVarint(buffer, end - start);
+				written = end;
+			}
+			start = row_start + s;
+			end = row_start + e;
+			pending = true;
+		});
+	}
+	if(pending){
+		putVarint(buffer, start - written);
+		putVarint(buffer, end - start);
+		written = end;
+	}
+	if(!pending || written < total)
+		putVarint(buffer, total - written);
+}
+
+bool MaskWriter::write(int frame_id, const Mat& fore, const vector<Rect>& bboxes, const vector<RotatedRect>& rot_bboxes){
+	if(!isOpened())	return false;
+	if(fore.rows != height || fore.cols != width || fore.type() != CV_8UC1){
+		cerr << "mask is not " << width << "x" << height << " CV_8UC1" << endl;
+		return false;
+	}
+	encodeRuns(fore, buffer);
+	return writeRecord(frame_id, bboxes, rot_bboxes);
+}
+
+bool MaskWriter::write(int frame_id, const BitMask& fore, const vector<Rect>& bboxes, const vector<RotatedRect>& rot_bboxes){
+	if(!isOpened())	return false;
+	if(fore.getHeight() != height || fore.getWidth() != width){
+		cerr << "mask is not " << width << "x" << height << endl;
+		return false;
+	}
+	encodeRuns(fore, buffer);
+	return writeRecord(frame_id, bboxes, rot_bboxes);
+}
+
+// buffer holds the encoded mask
+bool MaskWriter::writeRecord(int frame_id, const vector<Rect>& bboxes, const vector<RotatedRect>& rot_bboxes){
+	// enough digits for every float to read back to the same value
+	ostringstream ss;
+	ss << setprecision(numeric_limits<float>::max_digits10);
+	ss << "{\"frame\":" << frame_id << ",\"bboxes\":[";
+	for(unsigned int i = 0; i < bboxes.size(); i++){
+		const Rect& b = bboxes[i];
+		ss << (i ? "," : "") << "[" << b.x << "," << b.y << "," << b.width << "," << b.height << "]";
+	}
+	ss << "],\"rot_bboxes\":[";
+	for(unsigned int i = 0; i < rot_bboxes.size(); i++){
+		const RotatedRect& r = rot_bboxes[i];
+		ss << (i ? "," : "") << "[" << r.center.x << "," << r.center.y << ","
+			<< r.size.width << "," << r.size.height << "," << r.angle << "]";
+	}
+	ss << "]}";
+	line = ss.str();
+	return writeEncoded(frame_id, buffer, line);
+}
+
+bool MaskWriter::writeEncoded(int frame_id, const vector<uint8_t>& runs, const string& meta_line){
+	if(!isOpened())	return false;
+	index.push_back(MaskIndexEntry(frame_id, mask_file.tellp(), meta_file.tellp()));
+
+	writeValue(mask_file, int32_t(frame_id));
+	writeValue(mask_file, uint32_t(runs.size()));
+	mask_file.write(reinterpret_cast<const char*>(runs.data()), runs.size());
+
+	meta_file.write(meta_line.data(), meta_line.size());
+	meta_file.put('\n');
+
+	return bool(mask_file) && bool(meta_file);
+}
+
+void MaskWriter::close(){
+	if(!isOpened())	return;
+
+	uint64_t index_offset = mask_file.tellp();
+	for(const auto& e : index){
+		writeValue(mask_file, int32_t(e.frame_id));
+		writeValue(mask_file, e.mask_offset);
+		writeValue(mask_file, e.meta_offset);
+	}
+	writeValue(mask_file, index_offset);
+	writeValue(mask_file, uint32_t(index.size()));
+	mask_file.write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+
+	mask_file.close();
+	meta_file.close();
+}
+
+
+MaskReader::MaskReader():width(0), height(0){}
+
+bool MaskReader::open(const string& file_name){
+	close();
+	mask_file.open(file_name.c_str(), ios::binary);
+	if(!mask_file.is_open()){
+		cerr << "Failed to open file " << file_name << endl;
+		return false;
+	}
+	meta_file.open((file_name + ".jsonl").c_str(), ios::binary);
+	if(!meta_file.is_open())
+		cerr << "No blob file for " << file_name << ", reading masks only" << endl;
+
+	char magic[8];
+	uint32_t version = 0;
+	int32_t w = 0, h = 0;
+	if(!mask_file.read(magic, sizeof(magic)) || memcmp(magic, MASK_MAGIC, sizeof(magic)) != 0
+			|| !readValue(mask_file, version) || version != MASK_VERSION
+			|| !readValue(mask_file, w) || !readValue(mask_file, h)){
+		cerr << file_name << " is not a mask file" << endl;
+		close();
+		return false;
+	}
+	width = w;
+	height = h;
+
+	if(!readIndex())
+		scanIndex();
+	return true;
+}
+
+void MaskReader::close(){
+	mask_file.close();
+	meta_file.close();
+	index.clear();
+}
+
+bool MaskReader::readIndex(){
+	mask_file.clear();
+	mask_file.seekg(0, ios::end);
+	int64_t file_size = mask_file.tellg();
+	if(file_size < HEADER_SIZE + FOOTER_SIZE)	return false;
+
+	uint64_t index_offset;
+	uint32_t count;
+	char magic[8];
+	mask_file.seekg(file_size - FOOTER_SIZE);
+	if(!readValue(mask_file, index_offset) || !readValue(mask_file, count)
+			|| !mask_file.read(magic, sizeof(magic)) || memcmp(magic, INDEX_MAGIC, sizeof(magic)) != 0)
+		return false;
+
+	index.resize(count);
+	mask_file.seekg(index_offset);
+	for(auto& e : index){
+		int32_t frame_id;
+		if(!readValue(mask_file, frame_id) || !readValue(mask_file, e.mask_offset) || !readValue(mask_file, e.meta_offset)){
+			index.clear();
+			return false;
+		}
+		e.frame_id = frame_id;
+	}
+	return true;
+}
+
+// rebuild the index of a file that was not closed properly
+void MaskReader::scanIndex(){
+	cout << "mask index missing, scanning the file" << endl;
+	index.clear();
+	mask_file.clear();
+	mask_file.seekg(0, ios::end);
+	uint64_t file_size = mask_file.tellg();
+
+	uint64_t offset = HEADER_SIZE;
+	mask_file.seekg(offset);
+	int32_t frame_id;
+	uint32_t size;
+	// stop at the first truncated record
+	while(readValue(mask_file, frame_id) && readValue(mask_file, size) && offset + 8 + size <= file_size){
+		index.push_back(MaskIndexEntry(frame_id, offset, NO_META));
+		offset += 8 + size;
+		mask_file.seekg(offset);
+	}
+
+	// blob lines are written in the same order as the masks
+	if(meta_file.is_open()){
+		meta_file.clear();
+		meta_file.seekg(0);
+		string line;
+		for(auto& e : index){
+			uint64_t line_offset = meta_file.tellg();
+			if(!getline(meta_file, line) || meta_file.eof())	break;
+			e.meta_offset = line_offset;
+		}
+	}
+	mask_file.clear();
+}
+
+int MaskReader::findFrame(int frame_id)	const{
+	for(unsigned int i = 0; i < index.size(); i++)
+		if(index[i].frame_id == frame_id)
+			return i;
+	return -1;
+}
+
+bool MaskReader::decodeRuns(const uint8_t* data, size_t size, Mat& fore){
+	const uint8_t* p = data;
+	const uint8_t* end = data + size;
+	uchar value = COLOR_BACKGROUND;
+	size_t total = fore.total(), pos = 0;
+	uchar* out = fore.ptr<uchar>();
+	while(p < end){
+		uint32_t run;
+		if(!getVarint(p, end, run) || pos + run > total)
+			return false;
+		memset(out + pos, value, run);
+		pos += run;
+		value = (value == COLOR_BACKGROUND) ? COLOR_FOREGROUND : COLOR_BACKGROUND;
+	}
+	return pos == total;
+}
+
+bool MaskReader::readRuns(int i, vector<uint8_t>& runs){
+	if(i < 0 || i >= (int)index.size())	return false;
+
+	int32_t frame_id;
+	uint32_t size;
+	mask_file.clear();
+	mask_file.seekg(index[i].mask_offset);
+	if(!readValue(mask_file, frame_id) || !readValue(mask_file, size))
+		return false;
+	runs.resize(size);
+	return bool(mask_file.read(reinterpret_cast<char*>(runs.data()), size));
+}
+
+bool MaskReader::readEncoded(int i, vector<uint8_t>& runs, string& meta_line){
+	if(!readRuns(i, runs))
+		return false;
+	meta_line.clear();
+	if(!meta_file.is_open() || index[i].meta_offset == NO_META)
+		return true;
+	meta_file.clear();
+	meta_file.seekg(index[i].meta_offset);
+	return bool(getline(meta_file, meta_line));
+}
+
+bool MaskReader::read(int i, Mat& fore, vector<Rect>* bboxes, vector<RotatedRect>* rot_bboxes){
+	if(!readRuns(i, buffer))
+		return false;
+
+	fore.create(height, width, CV_8UC1);
+	if(!decodeRuns(buffer.data(), buffer.size(), fore)){
+		cerr << "corrupted mask of frame " << index[i].frame_id << endl;
+		return false;
+	}
+
+	if(bboxes)	bboxes->clear();
+	if(rot_bboxes)	rot_bboxes->clear();
+	if((bboxes || rot_bboxes) && meta_file.is_open() && index[i].meta_offset != NO_META)
+		return readMeta(index[i].meta_offset, bboxes, rot_bboxes);
+	return true;
+}
+
+// parse the groups of numbers of the array following key, e.g. "bboxes":[[1,2,3,4],[5,6,7,8]]
+static void parseGroups(const string& line, const string& key, int group_size, vector<float>& values){
+	values.clear();
+	size_t pos = line.find("\"" + key + "\":[");
+	if(pos == string::npos)	return;
+	const char* p = line.c_str() + pos + key.size() + 4;
+	int depth = 1;
+	while(*p && depth > 0){
+		if(*p == '[')	depth++;
+		else if(*p == ']')	depth--;
+		else if(*p == '-' || isdigit(*p)){
+			char* next;
+			values.push_back(strtof(p, &next));
+			p = next;
+			continue;
+		}
+		p++;
+	}
+	values.resize(values.size() - values.size()%group_size);
+}
+
+bool MaskReader::readMeta(uint64_t offset, vector<Rect>* bboxes, vector<RotatedRect>* rot_bboxes){
+	string line;
+	meta_file.clear();
+	meta_file.seekg(offset);
+	if(!getline(meta_file, line))
+		return false;
+
+	vector<float> v;
+	if(bboxes){
+		parseGroups(line, "bboxes", 4, v);
+		for(unsigned int i = 0; i < v.size(); i += 4)
+			bboxes->push_back(Rect(v[i], v[i+1], v[i+2], v[i+3]));
+	}
+	if(rot_bboxes){
+		parseGroups(line, "rot_bboxes", 5, v);
+		for(unsigned int i = 0; i < v.size(); i += 5)
+			rot_bboxes->push_back(RotatedRect(Point2f(v[i], v[i+1]), Size2f(v[i+2], v[i+3]), v[i+4]));
+	}
+	return true;
+}
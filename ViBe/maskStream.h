@@ -0,0 +1,105 @@
+#include <opencv2/opencv.hpp>
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "bitMask.h"
+
+#ifndef MASK_STREAM_H
+#define MASK_STREAM_H
+
+/*
+ * Lossless storage of the foreground masks and blobs of a video.
+ *
+ * <name> holds the masks:
+ *   header:  "VIBEMASK" version(u32) width(i32) height(i32)
+ *   records: frame_id(i32) size(u32) runs
+ *            runs are the lengths of alternating background/foreground runs in row
+ *            major order, starting with background, each encoded as a LEB128 varint
+ *   index:   frame_count x (frame_id(i32) mask_offset(u64) meta_offset(u64))
+ *   footer:  index_offset(u64) frame_count(u32) "VIBEIDX1"
+ * <name>.jsonl holds one line per frame with the blobs:
+ *   {"frame":12,"bboxes":[[x,y,w,h],...],"rot_bboxes":[[cx,cy,w,h,angle],...]}
+ *
+ * The index gives random access to any frame. A file without footer, e.g. from a
+ * process that was killed, is still readable, the index is rebuilt by scanning.
+ */
+
+struct MaskIndexEntry{
+	MaskIndexEntry(int f_id = -1, uint64_t m = 0, uint64_t b = 0):frame_id(f_id), mask_offset(m), meta_offset(b){}
+	int frame_id;
+	uint64_t mask_offset;
+	uint64_t meta_offset;
+};
+
+class MaskWriter{
+public:
+	MaskWriter();
+	~MaskWriter();
+
+	bool open(const std::string& file_name, int width, int height);
+	bool isOpened()	const{	return mask_file.is_open();	}
+	// fore is a CV_8UC1 mask, any non zero pixel is foreground
+	bool write(int frame_id, const cv::Mat& fore, const std::vector<cv::Rect>& bboxes, const std::vector<cv::RotatedRect>& rot_bboxes);
+	// the same from a bit mask, without going through bytes
+	bool write(int frame_id, const BitMask& fore, const std::vector<cv::Rect>& bboxes, const std::vector<cv::RotatedRect>& rot_bboxes);
+	// a record already encoded in this format, e.g. read with MaskReader::readEncoded,
+	// written as it is: runs is the encoded mask and meta_line the blob line without its newline
+	bool writeEncoded(int frame_id, const std::vector<uint8_t>& runs, const std::string& meta_line);
+	// write the index and close both files
+	void close();
+
+	// encode a mask to runs, exposed for other writers of the same format
+	static void encodeRuns(const cv::Mat& fore, std::vector<uint8_t>& buffer);
+	static void encodeRuns(const BitMask& fore, std::vector<uint8_t>& buffer);
+
+private:
+	int width, height;
+	std::ofstream mask_file;
+	std::ofstream meta_file;
+	std::vector<MaskIndexEntry> index;
+	std::vector<uint8_t> buffer;
+	std::string line;
+
+	bool writeRecord(int frame_id, const std::vector<cv::Rect>& bboxes, const std::vector<cv::RotatedRect>& rot_bboxes);
+};
+
+class MaskReader{
+public:
+	MaskReader();
+
+	bool open(const std::string& file_name);
+	bool isOpened()	const{	return mask_file.is_open();	}
+	void close();
+
+	int getFrameCount()	const{	return index.size();	}
+	int getWidth()	const{	return width;	}
+	int getHeight()	const{	return height;	}
+	int getFrameId(int i)	const{	return index[i].frame_id;	}
+	// position of frame_id in the file, -1 if it was not written
+	int findFrame(int frame_id)	const;
+
+	// read the i-th written frame, mask is CV_8UC1 with COLOR_FOREGROUND/COLOR_BACKGROUND
+	bool read(int i, cv::Mat& fore, std::vector<cv::Rect>* bboxes = NULL, std::vector<cv::RotatedRect>* rot_bboxes = NULL);
+	// the i-th record as it is stored, without decoding: the encoded runs and the blob line,
+	// empty when there is no blob file
+	bool readEncoded(int i, std::vector<uint8_t>& runs, std::string& meta_line);
+
+	static bool decodeRuns(const uint8_t* data, size_t size, cv::Mat& fore);
+
+private:
+	int width, height;
+	std::ifstream mask_file;
+	std::ifstream meta_file;
+	std::vector<MaskIndexEntry> index;
+	std::vector<uint8_t> buffer;
+
+	bool readRuns(int i, std::vector<uint8_t>& runs);
+	bool readIndex();
+	void scanIndex();
+	bool readMeta(uint64_t offset, std::vector<cv::Rect>* bboxes, std::vector<cv::RotatedRect>* rot_bboxes);
+};
+
+#endif
@@ -0,0 +1,241 @@
+#include "rawReader.h"
+
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace cv;
+
+static string extension(const string& file_name){
+	size_t dot = file_name.rfind('.');
+	if(dot == string::npos)	return "";
+	string ext = file_name.substr(dot+1);
+	for(auto& c : ext)	c = tolower(c);
+	return ext;
+}
+
+RawVideoReader::RawVideoReader():
+	fd(-1),
+	data(NULL),
+	size(0),
+	width(0),
+	height(0),
+	format(RAW_I420),
+	fps(0),
+	frame_size(0),
+	position(0),
+	read_ahead(4)
+{}
+
+RawVideoReader::~RawVideoReader(){
+	close();
+}
+
+bool RawVideoReader::isRawFile(const string& file_name){
+	string ext = extension(file_name);
+	return ext == "y4m" || ext == "yuv" || ext == "gray" || ext == "bgr";
+}
+
+int RawVideoReader::formatFromName(const string& file_name){
+	string ext = extension(file_name);
+	if(ext == "gray")	return RAW_GRAY;
+	if(ext == "bgr")	return RAW_BGR;
+	return RAW_I420;
+}
+
+void RawVideoReader::close(){
+	if(data)	munmap(data, size);
+	if(fd >= 0)	::close(fd);
+	data = NULL;
+	fd = -1;
+	frame_offsets.clear();
+	position = 0;
+}
+
+bool RawVideoReader::open(const string& file_name, int w, int h, int f){
+	close();
+	fd = ::open(file_name.c_str(), O_RDONLY);
+	struct stat st;
+	if(fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0){
+		cerr << "Failed to open file " << file_name << endl;
+		close();
+		return false;
+	}
+	size = st.st_size;
+	void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if(p == MAP_FAILED){
+		cerr << "Failed to map file " << file_name << ": " << strerror(errno) << endl;
+		close();
+		return false;
+	}
+	data = static_cast<unsigned char*>(p);
+	madvise(data, size, MADV_SEQUENTIAL);
+
+	size_t offset = 0;
+	bool y4m = extension(file_name) == "y4m";
+	if(y4m){
+		if(!parseY4MHeader(offset)){
+			cerr << file_name << " is not a supported Y4M file" << endl;
+			close();
+			return false;
+		}
+	}else{
+		width = w;
+		height = h;
+		format = f;
+		fps = 0;
+		// WIDTHxHEIGHT in the file name
+		if(width <= 0 || height <= 0){
+			string name = file_name.substr(file_name.find_last_of("/") == string::npos ? 0 : file_name.find_last_of("/")+1);
+			for(size_t i = 0; i < name.size(); i++){
+				if(!isdigit(name[i]) || (i > 0 && isdigit(name[i-1])))	continue;
+				char* end;
+				long a = strtol(name.c_str()+i, &end, 10);
+				if(*end == 'x' && isdigit(end[1])){
+					width = a;
+					height = strtol(end+1, NULL, 10);
+					break;
+				}
+			}
+		}
+		if(width <= 0 || height <= 0){
+			cerr << "Unknown frame size of " << file_name << endl;
+			close();
+			return false;
+		}
+	}
+
+	switch(format){
+		case RAW_GRAY:	frame_size = width*height;	break;
+		case RAW_BGR:	frame_size = width*height*3;	break;
+		default:		frame_size = width*height*3/2;	break;
+	}
+	if((format == RAW_I420 || format == RAW_NV12) && (width%2 || height%2)){
+		cerr << "4:2:0 frames need an even size" << endl;
+		close();
+		return false;
+	}
+
+	// frame offsets, every Y4M frame has its own FRAME header line
+	while(offset < size){
+		if(y4m){
+			if(offset + 5 > size || memcmp(data+offset, "FRAME", 5) != 0)	break;
+			unsigned char* eol = (unsigned char*)memchr(data+offset, '\n', size-offset);
+			if(!eol)	break;
+			offset = eol - data + 1;
+		}
+		if(offset + frame_size > size)	break;
+		frame_offsets.push_back(offset);
+		offset += frame_size;
+	}
+
+	cout << "raw video " << width << "x" << height << ", " << frame_offsets.size() << " frames" << endl;
+	prefetch(0);
+	return !frame_offsets.empty();
+}
+
+// YUV4MPEG2 W<width> H<height> F<num>:<den> C<colorspace> ...
+bool RawVideoReader::parseY4MHeader(size_t& offset){
+	const char* magic = "YUV4MPEG2 ";
+	if(size < strlen(magic) || memcmp(data, magic, strlen(magic)) != 0)
+		return false;
+	unsigned char* eol = (unsigned char*)memchr(data, '\n', size);
+	if(!eol)	return false;
+	string header((char*)data, eol - data);
+	offset = eol - data + 1;
+
+	width = height = 0;
+	fps = 0;
+	format = RAW_I420;
+	size_t pos = 0;
+	while((pos = header.find(' ', pos)) != string::npos){
+		pos++;
+		if(pos >= header.size())	break;
+		const char* token = header.c_str() + pos;
+		switch(token[0]){
+			case 'W':	width = atoi(token+1);	break;
+			case 'H':	height = atoi(token+1);	break;
+			case 'F':{
+				int num = 0, den = 1;
+				if(sscanf(token+1, "%d:%d", &num, &den) == 2 && den > 0)
+					fps = num/double(den);
+				break;
+			}
+			case 'C':{
+				// only 8 bit 4:2:0 and mono, 420p10 and the other deep formats are rejected
+				string tag = header.substr(pos+1, header.find(' ', pos) - pos - 1);
+				if(tag == "mono")
+					format = RAW_GRAY;
+				else if(tag != "420" && tag != "420jpeg" && tag != "420mpeg2" && tag != "420paldv")
+					return false;
+				break;
+			}
+			default:	break;
+		}
+	}
+	return width > 0 && height > 0;
+}
+
+void RawVideoReader::prefetch(int frame){
+	if(read_ahead <= 0 || frame >= (int)frame_offsets.size())	return;
+	int last = std::min<int>(frame + read_ahead, frame_offsets.size()-1);
+	long page = sysconf(_SC_PAGESIZE);
+	size_t begin = frame_offsets[frame] & ~size_t(page-1);
+	size_t end = frame_offsets[last] + frame_size;
+	madvise(data + begin, end - begin, MADV_WILLNEED);
+}
+
+void RawVideoReader::setPosition(int frame){
+	position = std::max(0, std::min<int>(frame, frame_offsets.size()));
+	prefetch(position);
+}
+
+bool RawVideoReader::grab(){
+	if(position >= (int)frame_offsets.size())	return false;
+	position++;
+	return true;
+}
+
+bool RawVideoReader::read(Mat& frame, int view){
+	if(position >= (int)frame_offsets.size()){
+		frame.release();
+		return false;
+	}
+	unsigned char* p = data + frame_offsets[position];
+	// the next frames are loaded while this one is processed
+	if(position % std::max(1, read_ahead/2) == 0)
+		prefetch(position+1);
+	position++;
+
+	if(format == RAW_BGR){
+		frame = Mat(height, width, CV_8UC3, p);
+		if(view == VIEW_LUMA){
+			cvtColor(frame, converted, COLOR_BGR2GRAY);
+			frame = converted;
+		}
+		return true;
+	}
+	if(view == VIEW_LUMA || format == RAW_GRAY){
+		frame = Mat(height, width, CV_8UC1, p);
+		if(view == VIEW_COLOR){
+			cvtColor(frame, converted, COLOR_GRAY2BGR);
+			frame = converted;
+		}
+		return true;
+	}
+
+	Mat planar(height*3/2, width, CV_8UC1, p);
+	if(view == VIEW_PLANAR){
+		frame = planar;
+		return true;
+	}
+	cvtColor(planar, converted, format == RAW_NV12 ? COLOR_YUV2BGR_NV12 : COLOR_YUV2BGR_I420);
+	frame = converted;
+	return true;
+}
@@ -0,0 +1,72 @@
+#include <opencv2/opencv.hpp>
+
+#include <string>
+#include <vector>
+
+#ifndef RAW_READER_H
+#define RAW_READER_H
+
+// pixel formats of raw files
+#define RAW_GRAY 0		// 8 bit luma
+#define RAW_I420 1		// planar Y, U, V 4:2:0
+#define RAW_NV12 2		// planar Y, interleaved UV 4:2:0
+#define RAW_BGR 3		// packed 24 bit BGR
+
+// views handed out by read
+#define VIEW_LUMA 0		// CV_8UC1 luma plane, zero copy
+#define VIEW_PLANAR 1	// CV_8UC1 of height*3/2 rows holding the whole 4:2:0 frame, zero copy
+#define VIEW_COLOR 2	// CV_8UC3 BGR, zero copy for RAW_BGR, converted otherwise
+
+// Reader of uncompressed Y4M and raw YUV/gray/BGR files that bypasses VideoCapture.
+// The file is memory mapped and frames are handed out as views on the mapping, so replay
+// runs at memory speed and costs no decoding. The mapping is private: drawing on a frame
+// does not change the file.
+class RawVideoReader{
+public:
+	RawVideoReader();
+	~RawVideoReader();
+
+	// Y4M files describe themselves, raw files need their size and format. A size of 0 is
+	// taken from a WIDTHxHEIGHT part of the file name, e.g. street_640x480.yuv
+	bool open(const std::string& file_name, int width = 0, int height = 0, int format = RAW_I420);
+	bool isOpened()	const{	return data != NULL;	}
+	void close();
+
+	// files this reader handles, by extension: .y4m .yuv .gray .bgr
+	static bool isRawFile(const std::string& file_name);
+	static int formatFromName(const std::string& file_name);
+
+	int getWidth()	const{	return width;	}
+	int getHeight()	const{	return height;	}
+	int getFormat()	const{	return format;	}
+	double getFPS()	const{	return fps;	}
+	int getFrameCount()	const{	return frame_offsets.size();	}
+	int getPosition()	const{	return position;	}
+	void setPosition(int frame);
+
+	// frames after the current one the kernel is asked to load in advance (default 4)
+	void setReadAhead(int frames){	read_ahead = frames;	}
+
+	// view of the next frame, zero copy views stay valid until the reader is closed,
+	// converted ones until the next read
+	bool read(cv::Mat& frame, int view = VIEW_LUMA);
+	// skip the next frame
+	bool grab();
+
+private:
+	int fd;
+	unsigned char* data;
+	size_t size;
+	int width, height, format;
+	double fps;
+	size_t frame_size;
+	std::vector<size_t> frame_offsets;
+	int position;
+	int read_ahead;
+	cv::Mat converted;		// VIEW_COLOR of yuv frames
+
+	bool parseY4MHeader(size_t& offset);
+	void prefetch(int frame);
+};
+
+#endif
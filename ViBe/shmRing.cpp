@@ -0,0 +1,228 @@
+#include "shmRing.h"
+
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace cv;
+
+static const char RING_MAGIC[8] = {'V','I','B','E','R','I','N','G'};
+
+// slots are cache line aligned and start after the ring header
+static size_t align64(size_t n){	return (n + 63) & ~size_t(63);	}
+
+static uint8_t* slotAt(const ShmRingHeader* header, uint64_t seq){
+	uint8_t* base = (uint8_t*)header + align64(sizeof(ShmRingHeader));
+	return base + (seq % header->slot_count)*header->slot_size;
+}
+
+static const size_t SLOT_MASK_OFFSET = align64(sizeof(ShmSlotHeader));
+
+ShmPublisher::ShmPublisher():size(0), header(NULL){}
+
+ShmPublisher::~ShmPublisher(){
+	close();
+}
+
+bool ShmPublisher::open(const string& shm_name, int width, int height, int slot_count, int max_blobs){
+	close();
+	name = shm_name[0] == '/' ? shm_name : "/" + shm_name;
+
+	size_t slot_size = align64(SLOT_MASK_OFFSET + align64(width*height) + max_blobs*sizeof(ShmBlob));
+	size = align64(sizeof(ShmRingHeader)) + slot_count*slot_size;
+
+	int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0666);
+	if(fd < 0){
+		cerr << "Failed to create shared memory " << name << ": " << strerror(errno) << endl;
+		return false;
+	}
+	if(ftruncate(fd, size) != 0){
+		cerr << "Failed to resize shared memory " << name << ": " << strerror(errno) << endl;
+		::close(fd);
+		shm_unlink(name.c_str());
+		return false;
+	}
+	void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if(p == MAP_FAILED){
+		cerr << "Failed to map shared memory " << name << ": " << strerror(errno) << endl;
+		shm_unlink(name.c_str());
+		return false;
+	}
+
+	// the memory is zero filled, every slot lock starts as "never published"
+	header = new (p) ShmRingHeader;
+	header->version = SHM_RING_VERSION;
+	header->slot_count = slot_count;
+	header->slot_size = slot_size;
+	header->width = width;
+	header->height = height;
+	header->max_blobs = max_blobs;
+	header->write_seq.store(0);
+	for(int i = 0; i < slot_count; i++)
+		new (slotAt(header, i)) ShmSlotHeader;
+	// readers check the magic last
+	atomic_thread_fence(memory_order_release);
+	memcpy(header->magic, RING_MAGIC, sizeof(RING_MAGIC));
+	return true;
+}
+
+void ShmPublisher::close(){
+	if(!header)	return;
+	munmap(header, size);
+	shm_unlink(name.c_str());
+	header = NULL;
+}
+
+bool ShmPublisher::publish(int frame_id, const Mat& fore, const vector<Rect>& bboxes, const vector<RotatedRect>& rot_bboxes){
+	if(!header)	return false;
+	if(fore.rows != header->height || fore.cols != header->width || fore.type() != CV_8UC1){
+		cerr << "mask is not " << header->width << "x" << header->height << " CV_8UC1" << endl;
+		return false;
+	}
+
+	uint64_t seq = header->write_seq.load(memory_order_relaxed);
+	uint8_t* slot_data = slotAt(header, seq);
+	ShmSlotHeader* slot = reinterpret_cast<ShmSlotHeader*>(slot_data);
+
+	slot->lock.store(2*seq+1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	slot->frame_id = frame_id;
+	slot->timestamp = chrono::duration_cast<chrono::microseconds>(
+			chrono::steady_clock::now().time_since_epoch()).count();
+
+	uint8_t* mask = slot_data + SLOT_MASK_OFFSET;
+	for(int i = 0; i < fore.rows; i++)
+		memcpy(mask + i*fore.cols, fore.ptr<uchar>(i), fore.cols);
+
+	ShmBlob* blobs = reinterpret_cast<ShmBlob*>(mask + align64(fore.rows*fore.cols));
+	unsigned int count = std::min<size_t>(bboxes.size(), header->max_blobs);
+	for(unsigned int i = 0; i < count; i++){
+		const Rect& b = bboxes[i];
+		ShmBlob& blob = blobs[i];
+		blob.x = b.x;
+		blob.y = b.y;
+		blob.width = b.width;
+		blob.height = b.height;
+		if(i < rot_bboxes.size()){
+			const RotatedRect& r = rot_bboxes[i];
+			blob.cx = r.center.x;
+			blob.cy = r.center.y;
+			blob.rot_width = r.size.width;
+			blob.rot_height = r.size.height;
+			blob.angle = r.angle;
+		}else{
+			blob.cx = blob.cy = blob.rot_width = blob.rot_height = blob.angle = 0;
+		}
+	}
+	slot->blob_count = count;
+	slot->total_blobs = bboxes.size();
+
+	slot->lock.store(2*seq+2, memory_order_release);
+	header->write_seq.store(seq+1, memory_order_release);
+	return true;
+}
+
+
+ShmSubscriber::ShmSubscriber():size(0), header(NULL), next_seq(0), dropped(0){}
+
+ShmSubscriber::~ShmSubscriber(){
+	close();
+}
+
+bool ShmSubscriber::open(const string& shm_name){
+	close();
+	string name = shm_name[0] == '/' ? shm_name : "/" + shm_name;
+
+	int fd = shm_open(name.c_str(), O_RDONLY, 0);
+	if(fd < 0){
+		cerr << "Failed to open shared memory " << name << ": " << strerror(errno) << endl;
+		return false;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ShmRingHeader)){
+		cerr << "Shared memory " << name << " is not ready" << endl;
+		::close(fd);
+		return false;
+	}
+	size = st.st_size;
+	void* p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if(p == MAP_FAILED){
+		cerr << "Failed to map shared memory " << name << ": " << strerror(errno) << endl;
+		return false;
+	}
+
+	header = static_cast<const ShmRingHeader*>(p);
+	if(memcmp(header->magic, RING_MAGIC, sizeof(RING_MAGIC)) != 0 || header->version != SHM_RING_VERSION){
+		cerr << "Shared memory " << name << " is not a ViBe ring" << endl;
+		close();
+		return false;
+	}
+	atomic_thread_fence(memory_order_acquire);
+
+	uint64_t written = header->write_seq.load(memory_order_acquire);
+	next_seq = written > 0 ? written-1 : 0;
+	dropped = 0;
+	return true;
+}
+
+void ShmSubscriber::close(){
+	if(!header)	return;
+	munmap(const_cast<ShmRingHeader*>(header), size);
+	header = NULL;
+}
+
+bool ShmSubscriber::acquire(ShmFrame& frame){
+	if(!header)	return false;
+
+	while(true){
+		uint64_t written = header->write_seq.load(memory_order_acquire);
+		if(next_seq >= written)	return false;
+
+		// the oldest frames were overwritten, skip them
+		if(written - next_seq > header->slot_count){
+			dropped += written - header->slot_count - next_seq;
+			next_seq = written - header->slot_count;
+		}
+
+		const uint8_t* slot_data = slotAt(header, next_seq);
+		const ShmSlotHeader* slot = reinterpret_cast<const ShmSlotHeader*>(slot_data);
+		uint64_t lock = slot->lock.load(memory_order_acquire);
+		if(lock != 2*next_seq+2){
+			// the publisher lapped us while we were looking, try the next one
+			dropped++;
+			next_seq++;
+			continue;
+		}
+
+		const uint8_t* mask = slot_data + SLOT_MASK_OFFSET;
+		frame.seq = next_seq;
+		frame.frame_id = slot->frame_id;
+		frame.timestamp = slot->timestamp;
+		frame.mask = Mat(header->height, header->width, CV_8UC1, const_cast<uint8_t*>(mask));
+		frame.blob_count = std::min(slot->blob_count, header->max_blobs);
+		frame.total_blobs = slot->total_blobs;
+		frame.blobs = reinterpret_cast<const ShmBlob*>(mask + align64(header->width*header->height));
+		frame.lock = lock;
+		frame.slot = slot;
+		next_seq++;
+
+		if(validate(frame))
+			return true;
+		dropped++;
+	}
+}
+
+bool ShmSubscriber::validate(const ShmFrame& frame)	const{
+	atomic_thread_fence(memory_order_acquire);
+	return frame.slot->lock.load(memory_order_relaxed) == frame.lock;
+}
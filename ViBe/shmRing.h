@@ -0,0 +1,105 @@
+#include <opencv2/opencv.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+/*
+ * POSIX shared memory ring buffer publishing the foreground mask and blobs of every frame
+ * to readers on the same host.
+ *
+ * One publisher writes frames in sequence order, frame n goes to slot n % slot_count.
+ * Every slot is guarded by a sequence lock so readers never block the publisher: a reader
+ * gets a view straight into the shared memory and checks after using it that the slot was
+ * not overwritten meanwhile. A reader that falls more than slot_count frames behind skips
+ * to the oldest frame still in the ring and the skipped frames are counted as dropped.
+ */
+
+#define SHM_RING_VERSION 2
+
+struct ShmBlob{
+	int32_t x, y, width, height;		// bounding box
+	float cx, cy, rot_width, rot_height, angle;	// rotated bounding box
+};
+
+struct ShmRingHeader{
+	char magic[8];
+	uint32_t version;
+	uint32_t slot_count;
+	uint64_t slot_size;
+	int32_t width, height;
+	uint32_t max_blobs;
+	std::atomic<uint64_t> write_seq;	// number of frames published
+};
+
+struct ShmSlotHeader{
+	std::atomic<uint64_t> lock;	// 2*seq+1 while frame seq is written, 2*seq+2 once it is published
+	int32_t frame_id;
+	uint32_t blob_count;	// blobs in the slot, at most max_blobs
+	uint32_t total_blobs;	// blobs of the frame, more than blob_count if the list was cut
+	int64_t timestamp;		// publisher clock in microseconds
+};
+
+// a published frame, the memory belongs to the ring and is read only
+struct ShmFrame{
+	uint64_t seq;
+	int frame_id;
+	int64_t timestamp;
+	cv::Mat mask;			// CV_8UC1 view on the shared memory
+	int blob_count;
+	int total_blobs;		// more than blob_count if the publisher cut the list at max_blobs
+	const ShmBlob* blobs;
+	uint64_t lock;			// slot lock value when the frame was acquired
+	const ShmSlotHeader* slot;
+};
+
+class ShmPublisher{
+public:
+	ShmPublisher();
+	~ShmPublisher();
+
+	bool open(const std::string& name, int width, int height, int slot_count = 8, int max_blobs = 256);
+	bool isOpened()	const{	return header != NULL;	}
+	// remove the shared memory, readers that already mapped it keep their mapping
+	void close();
+
+	// blobs beyond max_blobs are not published, readers see how many there were
+	bool publish(int frame_id, const cv::Mat& fore, const std::vector<cv::Rect>& bboxes, const std::vector<cv::RotatedRect>& rot_bboxes);
+
+private:
+	std::string name;
+	size_t size;
+	ShmRingHeader* header;
+};
+
+class ShmSubscriber{
+public:
+	ShmSubscriber();
+	~ShmSubscriber();
+
+	// start with the latest published frame
+	bool open(const std::string& name);
+	bool isOpened()	const{	return header != NULL;	}
+	void close();
+
+	int getWidth()	const{	return header->width;	}
+	int getHeight()	const{	return header->height;	}
+	uint64_t getDropped()	const{	return dropped;	}
+
+	// get the next frame without copying it, false if no new frame was published
+	bool acquire(ShmFrame& frame);
+	// true if the frame was not overwritten while it was used
+	bool validate(const ShmFrame& frame)	const;
+
+private:
+	size_t size;
+	const ShmRingHeader* header;
+	uint64_t next_seq;
+	uint64_t dropped;
+};
+
+#endif
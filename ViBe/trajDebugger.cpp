@@ -239,7 +239,8 @@ string TrajDebugger::getFileDirPath(const string& file_path)   const{
 
 
 void TrajDebugger::GTForeMask(const cv::Mat& frame, const cv::Mat& fore, int frame_num, const cv::Scalar& correct_color, const cv::Scalar& incorrect_color, cv::Mat& mask)	const {
-	mask = frame.clone();
+	// reuse the buffer of mask from the previous frame
+	frame.copyTo(mask);
 	// iterate through each trajectory vector
 	for(const auto& gt_vec: ground_truth) {
 		if(gt_vec.second.front().frame_id > frame_num || gt_vec.second.back().frame_id < frame_num)
@@ -64,6 +64,7 @@ public:
 	// to_frame_num = -1 means read until end of file
     
 	bool readGroundTruthFromFile(const std::string& filename, int to_frame_num = -1);
+	const std::map<int, TrajVec>& getGroundTruth()	const {	return ground_truth;	}
 	// print functionvoid 
 	void printTrajectorySummary(int obj_id)	const;
 	void cleanGroundTruth();